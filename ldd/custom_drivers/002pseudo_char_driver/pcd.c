@@ -5,6 +5,8 @@
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
 
+#include "pcd_core.h"
+
 #define DEV_MEM_SIZE    (512)
 
 /* Format pr_info() so it prints funtion name first */
@@ -14,6 +16,13 @@
 /* pseudo device's memory */
 static char device_buffer[DEV_MEM_SIZE];
 
+/* pcd_core runs the read/write/seek path over device_buffer */
+static struct pcd_dev pcd = {
+    .size = DEV_MEM_SIZE,
+    .perm = PERM_RDWR,
+    .sn = "pcd",
+};
+
 /* to hold device number */
 static dev_t dev_num;
 
@@ -42,8 +51,15 @@ struct device *device_pcd;
 
 static int pcd_open(struct inode *inode, struct file *fh)
 {
+    int rc;
+
     pr_info("PCD Device open sys called\n");
-    return 0;
+
+    rc = pcd_core_open(&pcd, fh);
+    if (rc)
+        pr_info("PCD Device open failed rc: %d\n", rc);
+
+    return rc;
 }
 
 /* Only called when references to driver count reaches 0
@@ -56,85 +72,56 @@ static int pcd_release(struct inode *inode, struct file *fh)
 
 static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos)
 {
+    ssize_t ret;
     pr_info("PCD Device read called for %zu bytes cur f_pos=%lld\n", count, *f_pos);
-    
-    if (*f_pos >= DEV_MEM_SIZE)
-        return 0;
-
-    if ((*f_pos + count) > DEV_MEM_SIZE)
-        count = DEV_MEM_SIZE - *f_pos;
 
-    if (copy_to_user(buf, &device_buffer[*f_pos], count))
-        return -EFAULT;
+    ret = pcd_core_read(&pcd, NULL, buf, count, f_pos, fh->f_flags);
+    if (ret > 0)
+        pr_info("PCD Device read successfully read %zd bytes, new f_pos=%lld\n", ret, *f_pos);
 
-    *f_pos += count;
-
-    pr_info("PCD Device read successfully read %zu bytes, new f_pos=%lld\n", count, *f_pos);
-
-    return count;
+    return ret;
 }
 
 static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
 {
+    ssize_t ret;
     pr_info("PCD Device write called for %zu bytes cur f_pos=%lld\n", count, *f_pos);
 
-    if ((*f_pos + count) > DEV_MEM_SIZE)
-        count = DEV_MEM_SIZE - *f_pos;
-    
-    if (!count)
-        return -ENOMEM;
-    
-    if (copy_from_user(&device_buffer[*f_pos], buf, count))
-        return -EFAULT;
-
-    *f_pos += count;
+    ret = pcd_core_write(&pcd, NULL, buf, count, f_pos, fh->f_flags);
+    if (ret > 0)
+        pr_info("PCD Device write successfully read %zd bytes, new f_pos=%lld\n", ret, *f_pos);
 
-    pr_info("PCD Device write successfully read %zu bytes, new f_pos=%lld\n", count, *f_pos);
-
-    return count;
+    return ret;
 }
 
 static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence)
 {
-    loff_t tmp;
+    loff_t ret;
 
     pr_info("PCD Device seek called cur f_pos=%lld + %lld\n", fh->f_pos, f_pos);
 
-    switch(whence) {
-    case SEEK_SET:
-        if (f_pos > DEV_MEM_SIZE || f_pos < 0)
-            return -EINVAL;
-        fh->f_pos = f_pos;
-        break;
-    case SEEK_CUR:
-        tmp = fh->f_pos + f_pos;
-        if (tmp > DEV_MEM_SIZE || tmp < 0)
-                return -EINVAL;
-        fh->f_pos = tmp;
-        break;
-    case SEEK_END:
-        tmp = DEV_MEM_SIZE + f_pos;
-        if (tmp > DEV_MEM_SIZE || tmp < 0)
-                return -EINVAL;
-        fh->f_pos = tmp;
-        break;
-    default:
-        return -EINVAL;
-    }
+    ret = pcd_core_llseek(&pcd, fh, f_pos, whence);
+    if (ret < 0)
+        return ret;
 
     pr_info("PCD Device seek new f_pos=%lld\n", fh->f_pos);
 
-    return fh->f_pos;
+    return ret;
 }
 
 static int __init pcd_driver_init(void)
 {
     int rc;
 
+    /* 0. Hand the device buffer to pcd_core */
+    rc = pcd_core_init(&pcd, PCD_BACKEND_STATIC, device_buffer);
+    if (rc < 0)
+        goto out;
+
     /* 1. Dynamically allocate a device driver number */
     rc = alloc_chrdev_region(&dev_num, 0, 1, "pcd_devices");
     if (rc < 0)
-        goto out;
+        goto core_free;
 
     /* 2. Init the cdev structure with fops */
     cdev_init(&pcd_cdev, &pcd_fops);
@@ -173,6 +160,8 @@ cdev_del:
     cdev_del(&pcd_cdev);
 unreg_chrdev:
     unregister_chrdev_region(dev_num, 1);
+core_free:
+    pcd_core_free(&pcd);
 out:
     pr_info("PCD module insertion failed\n");
     return rc;
@@ -185,6 +174,7 @@ static void __exit pcd_driver_cleanup(void)
     class_destroy(class_pcd);
     cdev_del(&pcd_cdev);
     unregister_chrdev_region(dev_num, 1);
+    pcd_core_free(&pcd);
     pr_info("PCD Device cleaning up maj: %u min: %u\n",
         MAJOR(dev_num), MINOR(dev_num));
 }
@@ -0,0 +1,55 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <linux/types.h>
+
+#include "pcd_ioctl.h"
+
+/* Mirrors PCDDEV3 into PCDDEV2 inside the kernel, no data passes through here */
+
+int main(int argc, char *argv[])
+{
+	int src, dst, ret;
+	struct pcd_copy_range req = { 0 };
+
+	if (argc != 2) {
+		printf("Wrong usage\n");
+		printf("Correct usage: <file> <copycount>\n");
+		return 0;
+	}
+
+	/*convert command line supplied data to integer */
+	req.len = strtoull(argv[1], NULL, 0);
+
+	src = open("/dev/pcdev-3", O_RDONLY);
+	if (src < 0) {
+		perror("open src");
+		return src;
+	}
+
+	/* PCDDEV2 is write only */
+	dst = open("/dev/pcdev-2", O_WRONLY);
+	if (dst < 0) {
+		perror("open dst");
+		close(src);
+		return dst;
+	}
+
+	req.src_fd = src;
+
+	ret = ioctl(dst, PCD_IOC_COPY, &req);
+	if (ret < 0)
+		perror("ioctl");
+	else
+		printf("copied %d bytes\n", ret);
+
+	close(dst);
+	close(src);
+
+	return ret < 0;
+}
@@ -3,24 +3,28 @@
 #include <linux/cdev.h>
 #include <linux/device.h>
 #include <linux/kdev_t.h>
+#include <linux/file.h>
+#include <linux/slab.h>
 #include <linux/uaccess.h>
 
+#include "pcd_core.h"
+#include "pcd_ioctl.h"
+
 #define NO_OF_DEVICES    (4)
 #define DEV1_MEM_SIZE    (1024)
 #define DEV2_MEM_SIZE    (1024)
 #define DEV3_MEM_SIZE    (1024)
 #define DEV4_MEM_SIZE    (1024)
 
-enum {
-    PERM_RDONLY = 0x1,
-    PERM_WRONLY = 0x10,
-    PERM_RDWR = 0x11,
-};
-
 /* Format pr_info() so it prints funtion name first */
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt, __func__
 
+/* Keep a CRC32C per block of each buffer, verified on every read */
+static bool crc_enable;
+module_param(crc_enable, bool, 0444);
+MODULE_PARM_DESC(crc_enable, "Maintain per-block CRC32C checksums of device buffers");
+
 /* pseudo device's memory */
 static char dev1_buffer[DEV1_MEM_SIZE];
 static char dev2_buffer[DEV2_MEM_SIZE];
@@ -33,16 +37,21 @@ static int pcd_release(struct inode *inode, struct file *fh);
 static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos);
 static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos);
 static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence);
+static long pcd_ioctl(struct file *fh, unsigned int cmd, unsigned long arg);
 
-/* pcd device private data */
+/* pcd device private data, pcd_core runs the data path over buf */
 struct pcdev_priv_data {
     char *buf;
-    unsigned size;
-    const char *sn;
-    int perm;
+    struct pcd_dev pcd;
     struct cdev cdev;
 };
 
+/* Per-open data, the client is scheduled against the other open files */
+struct pcd_file {
+    struct pcdev_priv_data *prv_data;
+    struct pcd_client client;
+};
+
 /* pcd drivers private data */
 struct pcddrv_priv_data {
     int total_devices;
@@ -58,6 +67,8 @@ static struct file_operations pcd_fops = {
     .llseek = pcd_llseek,
     .read = pcd_read,
     .write = pcd_write,
+    .unlocked_ioctl = pcd_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
     .open = pcd_open,
     .release = pcd_release
 };
@@ -67,49 +78,60 @@ struct pcddrv_priv_data pcdrv_data = {
     .pcdev_data = {
         [0] = {
             .buf = dev1_buffer,
-            .size = DEV1_MEM_SIZE,
-            .sn = "PCDDEV1",
-            .perm = PERM_RDONLY
+            .pcd = {
+                .size = DEV1_MEM_SIZE,
+                .sn = "PCDDEV1",
+                .perm = PERM_RDONLY
+            }
         },
         [1] = {
             .buf = dev2_buffer,
-            .size = DEV2_MEM_SIZE,
-            .sn = "PCDDEV2",
-            .perm = PERM_WRONLY
+            .pcd = {
+                .size = DEV2_MEM_SIZE,
+                .sn = "PCDDEV2",
+                .perm = PERM_WRONLY
+            }
         },
         [2] = {
             .buf = dev3_buffer,
-            .size = DEV3_MEM_SIZE,
-            .sn = "PCDDEV3",
-            .perm = PERM_RDWR
+            .pcd = {
+                .size = DEV3_MEM_SIZE,
+                .sn = "PCDDEV3",
+                .perm = PERM_RDWR
+            }
         },
         [3] = {
             .buf = dev4_buffer,
-            .size = DEV4_MEM_SIZE,
-            .sn = "PCDDEV4",
-            .perm = PERM_RDONLY
+            .pcd = {
+                .size = DEV4_MEM_SIZE,
+                .sn = "PCDDEV4",
+                .perm = PERM_RDONLY
+            }
         }
     }
 };
 
-static int check_permission(int dev_perm, int acc_mode)
+/* sysfs attributes, all of them come from pcd_core */
+
+static struct pcd_dev *to_pcd(struct device *dev)
 {
-    if (dev_perm == PERM_RDWR)
-        return 0;
-    
-    if (dev_perm == PERM_RDONLY && (acc_mode & FMODE_READ) && !(acc_mode & FMODE_WRITE))
-        return 0;
-    
-    if (dev_perm == PERM_WRONLY && !(acc_mode & FMODE_READ) && (acc_mode & FMODE_WRITE))
-        return 0;
-
-    return -EPERM;
+    struct pcdev_priv_data *prv_data = dev_get_drvdata(dev);
+
+    return &prv_data->pcd;
 }
 
+static struct pcd_attr_group pcd_core_attrs;
+
+static const struct attribute_group *pcd_dev_groups[] = {
+    &pcd_core_attrs.group,
+    NULL
+};
+
 static int pcd_open(struct inode *inode, struct file *fh)
 {
     int rc;
     int minor_n;
+    struct pcd_file *pf;
     struct pcdev_priv_data *prv_data;
 
     /* Find out what device is being accessed */
@@ -119,100 +141,147 @@ static int pcd_open(struct inode *inode, struct file *fh)
     /* Get devices private data struct */
     prv_data = container_of(inode->i_cdev, struct pcdev_priv_data, cdev);
 
+    rc = pcd_core_open(&prv_data->pcd, fh);
+
+    if (rc) {
+        pr_info("PCD Device open failed for device %d rc: %d\n", minor_n, rc);
+        return rc;
+    }
+
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if (!pf)
+        return -ENOMEM;
+    pf->prv_data = prv_data;
+    pcd_client_init(&pf->client);
+
     /* Set private data of file handle for subsequent fh calls */
-    fh->private_data = prv_data;
+    fh->private_data = pf;
 
-    rc = check_permission(prv_data->perm, fh->f_mode);
+    pr_info("PCD Device open success for device %d\n", minor_n);
 
-    if (rc)
-        pr_info("PCD Device open failed for device %d rc: %d\n", minor_n, rc);
-    else 
-        pr_info("PCD Device open success for device %d\n", minor_n);
-    
-    return rc;
+    return 0;
 }
 
 /* Only called when references to driver count reaches 0
 * so not necessarily called on close(). */
 static int pcd_release(struct inode *inode, struct file *fh)
 {
+    kfree(fh->private_data);
+
     pr_info("PCD Device release called\n");
     return 0;
 }
 
 static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos)
 {
-    struct pcdev_priv_data *prv_data = fh->private_data;
-    pr_info("PCD Device on dev %s read called for %zu bytes cur f_pos=%lld\n", prv_data->sn, count, *f_pos);
-    
-    if (*f_pos >= prv_data->size)
-        return 0;
+    ssize_t ret;
+    struct pcd_file *pf = fh->private_data;
+    struct pcdev_priv_data *prv_data = pf->prv_data;
+    pr_info("PCD Device on dev %s read called for %zu bytes cur f_pos=%lld\n", prv_data->pcd.sn, count, *f_pos);
 
-    if ((*f_pos + count) > prv_data->size)
-        count = prv_data->size - *f_pos;
+    ret = pcd_core_read(&prv_data->pcd, &pf->client, buf, count, f_pos, fh->f_flags);
+    if (ret > 0)
+        pr_info("PCD Device read on dev %s successfully read %zd bytes, new f_pos=%lld\n", prv_data->pcd.sn, ret, *f_pos);
 
-    if (copy_to_user(buf, &prv_data->buf[*f_pos], count))
-        return -EFAULT;
+    return ret;
+}
 
-    *f_pos += count;
+static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
+{
+    ssize_t ret;
+    struct pcd_file *pf = fh->private_data;
+    struct pcdev_priv_data *prv_data = pf->prv_data;
+    pr_info("PCD Device on dev %s write called for %zu bytes cur f_pos=%lld\n", prv_data->pcd.sn, count, *f_pos);
 
-    pr_info("PCD Device read on dev %s successfully read %zu bytes, new f_pos=%lld\n", prv_data->sn, count, *f_pos);
+    ret = pcd_core_write(&prv_data->pcd, &pf->client, buf, count, f_pos, fh->f_flags);
+    if (ret > 0)
+        pr_info("PCD Device write on dev %s successfully read %zd bytes, new f_pos=%lld\n", prv_data->pcd.sn, ret, *f_pos);
 
-    return count;
+    return ret;
 }
 
-static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
+static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence)
 {
-    struct pcdev_priv_data *prv_data = fh->private_data;
-    pr_info("PCD Device on dev %s write called for %zu bytes cur f_pos=%lld\n", prv_data->sn, count, *f_pos);
+    loff_t ret;
+    struct pcdev_priv_data *prv_data = ((struct pcd_file *)fh->private_data)->prv_data;
+    pr_info("PCD Device on dev %s seek called cur f_pos=%lld + %lld\n", prv_data->pcd.sn, fh->f_pos, f_pos);
 
-    if ((*f_pos + count) > prv_data->size)
-        count = prv_data->size - *f_pos;
-    
-    if (!count)
-        return -ENOMEM;
-    
-    if (copy_from_user(&prv_data->buf[*f_pos], buf, count))
-        return -EFAULT;
+    ret = pcd_core_llseek(&prv_data->pcd, fh, f_pos, whence);
+    if (ret < 0)
+        return ret;
 
-    *f_pos += count;
+    pr_info("PCD Device %s seek new f_pos=%lld\n", prv_data->pcd.sn, fh->f_pos);
 
-    pr_info("PCD Device write on dev %s successfully read %zu bytes, new f_pos=%lld\n", prv_data->sn, count, *f_pos);
-
-    return count;
+    return ret;
 }
 
-static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence)
+/* Move data between two pcd devices without bouncing it through userspace.
+* Issued on the destination, the source fd must be another pcd device. */
+static long pcd_ioctl_copy(struct file *fh, struct pcd_copy_range __user *uarg)
 {
-    loff_t tmp;
-    struct pcdev_priv_data *prv_data = fh->private_data;
-    pr_info("PCD Device on dev %s seek called cur f_pos=%lld + %lld\n", prv_data->sn, fh->f_pos, f_pos);
-
-    switch(whence) {
-    case SEEK_SET:
-        if (f_pos > prv_data->size || f_pos < 0)
-            return -EINVAL;
-        fh->f_pos = f_pos;
-        break;
-    case SEEK_CUR:
-        tmp = fh->f_pos + f_pos;
-        if (tmp > prv_data->size || tmp < 0)
-                return -EINVAL;
-        fh->f_pos = tmp;
-        break;
-    case SEEK_END:
-        tmp = prv_data->size + f_pos;
-        if (tmp > prv_data->size || tmp < 0)
-                return -EINVAL;
-        fh->f_pos = tmp;
-        break;
-    default:
+    long rc;
+    struct fd src_fd;
+    struct pcd_copy_range req;
+    struct pcdev_priv_data *src, *dst = ((struct pcd_file *)fh->private_data)->prv_data;
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+
+    if (req.src_off > LLONG_MAX || req.dst_off > LLONG_MAX)
         return -EINVAL;
+
+    src_fd = fdget(req.src_fd);
+    if (!src_fd.file)
+        return -EBADF;
+
+    if (src_fd.file->f_op != &pcd_fops) {
+        rc = -EXDEV;
+        goto out;
     }
+    src = ((struct pcd_file *)src_fd.file->private_data)->prv_data;
 
-    pr_info("PCD Device %s seek new f_pos=%lld\n", prv_data->sn, fh->f_pos);
+    if (!(src_fd.file->f_mode & FMODE_READ) || !(fh->f_mode & FMODE_WRITE)) {
+        rc = -EBADF;
+        goto out;
+    }
 
-    return fh->f_pos;
+    rc = pcd_check_permission(src->pcd.perm, FMODE_READ);
+    if (!rc)
+        rc = pcd_check_permission(dst->pcd.perm, FMODE_WRITE);
+    if (rc)
+        goto out;
+
+    /* Source and destination may be the same device */
+    rc = pcd_core_copy(&dst->pcd, req.dst_off, &src->pcd, req.src_off, min_t(u64, req.len, SSIZE_MAX));
+    if (rc > 0)
+        pr_info("PCD Device copied %ld bytes from %s to %s\n", rc, src->pcd.sn, dst->pcd.sn);
+
+out:
+    fdput(src_fd);
+    return rc;
+}
+
+/* Only writers get to publish their writes */
+static long pcd_ioctl_commit(struct file *fh)
+{
+    struct pcdev_priv_data *prv_data = ((struct pcd_file *)fh->private_data)->prv_data;
+
+    if (!(fh->f_mode & FMODE_WRITE))
+        return -EBADF;
+
+    return pcd_db_commit(&prv_data->pcd);
+}
+
+static long pcd_ioctl(struct file *fh, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd) {
+    case PCD_IOC_COPY:
+        return pcd_ioctl_copy(fh, (struct pcd_copy_range __user *)arg);
+    case PCD_IOC_COMMIT:
+        return pcd_ioctl_commit(fh);
+    default:
+        return -ENOTTY;
+    }
 }
 
 static int __init pcd_driver_init(void)
@@ -220,6 +289,9 @@ static int __init pcd_driver_init(void)
     int rc;
     int i;
 
+    /* 0. sysfs attributes shared with the other pcd drivers */
+    pcd_attr_group_init(&pcd_core_attrs, to_pcd);
+
     /* 1. Dynamically allocate a device driver number */
     rc = alloc_chrdev_region(&pcdrv_data.dev_num, 0, NO_OF_DEVICES, "pcd_devs");
     if (rc < 0)
@@ -238,33 +310,53 @@ static int __init pcd_driver_init(void)
         pr_info("PCD Device init of maj: %u min: %u\n",
             MAJOR(pcdrv_data.dev_num + i), MINOR(pcdrv_data.dev_num + i));
 
-        /* 3. Init the cdev structure with fops */
+        /* 3. Hand the buffer to pcd_core and checksum its initial contents */
+        rc = pcd_core_init(&pcdrv_data.pcdev_data[i].pcd, PCD_BACKEND_STATIC, pcdrv_data.pcdev_data[i].buf);
+        if (rc < 0)
+            goto devs_del;
+
+        if (crc_enable) {
+            rc = pcd_crc_init(&pcdrv_data.pcdev_data[i].pcd);
+            if (rc < 0)
+                goto core_free;
+        }
+
+        /* 4. Init the cdev structure with fops */
         cdev_init(&pcdrv_data.pcdev_data[i].cdev, &pcd_fops);
         pcdrv_data.pcdev_data[i].cdev.owner = THIS_MODULE;
 
-        /* 4. Register cdev structure with virtual file sys (VFS) */
+        /* 5. Register cdev structure with virtual file sys (VFS) */
         rc = cdev_add(&pcdrv_data.pcdev_data[i].cdev, pcdrv_data.dev_num + i, 1);
         if (rc < 0)
-            goto cdev_del;
+            goto core_free;
         
-        /* 5. Populate the sysfs with device information */
-        pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd, NULL, pcdrv_data.dev_num + i, NULL, "pcdev-%d", i + 1);
+        /* 6. Populate the sysfs with device information */
+        pcdrv_data.device_pcd = device_create_with_groups(pcdrv_data.class_pcd, NULL, pcdrv_data.dev_num + i,
+            &pcdrv_data.pcdev_data[i], pcd_dev_groups, "pcdev-%d", i + 1);
         if (IS_ERR(pcdrv_data.device_pcd)) {
             pr_info("Device creation failed\n");
             rc = PTR_ERR(pcdrv_data.device_pcd);
-            goto cls_del;
+            goto cdev_del;
         }
+
+        /* 7. Heatmap and other debug files, removed by pcd_core_free() */
+        pcd_core_debugfs_add(&pcdrv_data.pcdev_data[i].pcd, dev_name(pcdrv_data.device_pcd));
     }
 
     pr_info("PCD Device module init successful\n");
 
     return 0;
 
-cls_del:
+    /* Device i got as far as the label, the ones before it all the way */
 cdev_del:
-    for (; i >= 0; --i) {
+    cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+core_free:
+    pcd_core_free(&pcdrv_data.pcdev_data[i].pcd);
+devs_del:
+    for (--i; i >= 0; --i) {
         device_destroy(pcdrv_data.class_pcd, pcdrv_data.dev_num + i);
         cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+        pcd_core_free(&pcdrv_data.pcdev_data[i].pcd);
     }
     class_destroy(pcdrv_data.class_pcd);
 unreg_chrdev:
@@ -285,6 +377,7 @@ static void __exit pcd_driver_cleanup(void)
 
         device_destroy(pcdrv_data.class_pcd, pcdrv_data.dev_num + i);
         cdev_del(&pcdrv_data.pcdev_data[i].cdev);
+        pcd_core_free(&pcdrv_data.pcdev_data[i].pcd);
     }
     class_destroy(pcdrv_data.class_pcd);
     unregister_chrdev_region(pcdrv_data.dev_num, NO_OF_DEVICES);
@@ -0,0 +1,27 @@
+#ifndef __PCD_IOCTL_H
+#define __PCD_IOCTL_H
+
+/* Shared between the pcd driver and its userspace clients */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Copy len bytes from src_fd at src_off into the device the ioctl is issued on at dst_off */
+struct pcd_copy_range {
+    __s32 src_fd;
+    __u32 reserved;
+    __u64 src_off;
+    __u64 dst_off;
+    __u64 len;
+};
+
+#define PCD_IOC_MAGIC       'p'
+
+/* Returns the number of bytes copied, clamped to both device sizes */
+#define PCD_IOC_COPY        _IOW(PCD_IOC_MAGIC, 2, struct pcd_copy_range)
+
+/* Publishes what was written since the last commit to readers of a device with
+* double_buffer set. Readers see either the old or the new contents, never a mix. */
+#define PCD_IOC_COMMIT      _IO(PCD_IOC_MAGIC, 4)
+
+#endif /* #ifndef __PCD_IOCTL_H */
@@ -0,0 +1,161 @@
+/*
+ * Throughput and scheduling latency benchmark for the pcd platform driver.
+ *
+ * For each transfer size from 4 KB to 64 MB the device is read and written
+ * with single pread()/pwrite() calls while a probe thread pinned to the same
+ * CPU sleeps for 1 ms at a time and records how late it wakes up. A driver
+ * that copies without preemption points shows up as large probe overshoot.
+ *
+ * Load the bulk device large enough first, e.g.
+ *	insmod pcd_device_setup.ko pcdev5_size=67108864
+ *	./pcd_bench /dev/pcdev-4
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MIN_XFER	(4UL << 10)
+#define MAX_XFER	(64UL << 20)
+#define BYTES_PER_RUN	(256UL << 20)
+#define PROBE_PERIOD_NS	1000000L
+
+static volatile int probe_run;
+static int64_t probe_max_ns;
+static int64_t probe_total_ns;
+static long probe_samples;
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void pin_to_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set))
+		perror("sched_setaffinity");
+}
+
+/* Sleeps one period at a time and records how late each wakeup is */
+static void *probe_thread(void *arg)
+{
+	struct timespec req = { .tv_sec = 0, .tv_nsec = PROBE_PERIOD_NS };
+	int64_t start, late;
+
+	pin_to_cpu(*(int *)arg);
+
+	while (probe_run) {
+		start = now_ns();
+		nanosleep(&req, NULL);
+		late = now_ns() - start - PROBE_PERIOD_NS;
+		if (late > probe_max_ns)
+			probe_max_ns = late;
+		probe_total_ns += late;
+		probe_samples++;
+	}
+
+	return NULL;
+}
+
+static int run(int fd, char *buf, size_t xfer, int do_write, int cpu)
+{
+	pthread_t probe;
+	size_t iters = BYTES_PER_RUN / xfer;
+	size_t total = 0;
+	int64_t start, elapsed;
+	ssize_t ret;
+
+	if (iters < 4)
+		iters = 4;
+
+	probe_max_ns = 0;
+	probe_total_ns = 0;
+	probe_samples = 0;
+	probe_run = 1;
+	if (pthread_create(&probe, NULL, probe_thread, &cpu)) {
+		perror("pthread_create");
+		return -1;
+	}
+
+	start = now_ns();
+	for (size_t i = 0; i < iters; i++) {
+		if (do_write)
+			ret = pwrite(fd, buf, xfer, 0);
+		else
+			ret = pread(fd, buf, xfer, 0);
+		if (ret < 0) {
+			perror(do_write ? "pwrite" : "pread");
+			break;
+		}
+		total += ret;
+	}
+	elapsed = now_ns() - start;
+
+	probe_run = 0;
+	pthread_join(probe, NULL);
+
+	printf("%-5s %9zu KB %10.1f MB/s   sched latency avg %7.1f us max %8.1f us\n",
+		do_write ? "write" : "read", xfer >> 10,
+		elapsed ? (double)total / elapsed * 1000.0 : 0.0,
+		probe_samples ? probe_total_ns / 1000.0 / probe_samples : 0.0,
+		probe_max_ns / 1000.0);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int fd, cpu = 0;
+	char *buf;
+
+	if (argc < 2) {
+		printf("Wrong usage\n");
+		printf("Correct usage: <file> <device> [cpu]\n");
+		return 0;
+	}
+
+	if (argc > 2)
+		cpu = atoi(argv[2]);
+
+	fd = open(argv[1], O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+
+	buf = malloc(MAX_XFER);
+	if (!buf) {
+		close(fd);
+		return 1;
+	}
+	memset(buf, 0xa5, MAX_XFER);
+
+	/* Benchmark and probe share a CPU so the probe sees any missing preemption */
+	pin_to_cpu(cpu);
+
+	for (size_t xfer = MIN_XFER; xfer <= MAX_XFER; xfer <<= 2) {
+		if (run(fd, buf, xfer, 1, cpu) || run(fd, buf, xfer, 0, cpu))
+			break;
+	}
+
+	free(buf);
+	close(fd);
+
+	return 0;
+}
@@ -1,5 +1,6 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
+#include <linux/sizes.h>
 
 #include "pcd_platform.h"
 
@@ -7,29 +8,43 @@
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt, __func__
 
-#define NO_OF_DEVICES   (4)
+#define NO_OF_DEVICES   (5)
+
+/* The bulk device is sized at load time for large transfer testing */
+static int pcdev5_size = SZ_1M;
+module_param(pcdev5_size, int, 0444);
+MODULE_PARM_DESC(pcdev5_size, "Buffer size in bytes of the bulk device PCDEV5");
 
 /* 1. Create plaform data */
 struct pcdev_platform_data pcdev_pdata[NO_OF_DEVICES] = {
     [0] = {
         .size = 512,
         .perm = PERM_RDWR,
+        .backend = PCD_BACKEND_SPARSE,
         .sn = "PCDEV1"
     },
     [1] = {
         .size = 256,
         .perm = PERM_RDWR,
+        .backend = PCD_BACKEND_SPARSE,
         .sn = "PCDEV2"
     },
     [2] = {
         .size = 128,
         .perm = PERM_RDONLY,
+        .backend = PCD_BACKEND_SPARSE,
         .sn = "PCDEV3"
     },
     [3] = {
         .size = 64,
         .perm = PERM_WRONLY,
+        .backend = PCD_BACKEND_SPARSE,
         .sn = "PCDEV4"
+    },
+    [4] = {
+        .perm = PERM_RDWR,
+        .backend = PCD_BACKEND_SPARSE,
+        .sn = "PCDEV5"
     }
 };
 
@@ -74,8 +89,17 @@ struct platform_device platform_pcdev4 = {
     }
 };
 
+struct platform_device platform_pcdev5 = {
+    .name = PCD_DEVICE_NAME "E1x",
+    .id = 4,
+    .dev = {
+        .platform_data = &pcdev_pdata[4],
+        .release = pcdev_release
+    }
+};
+
 struct platform_device *plat_devices_array[] = {
-    &platform_pcdev1, &platform_pcdev2, &platform_pcdev3, &platform_pcdev4
+    &platform_pcdev1, &platform_pcdev2, &platform_pcdev3, &platform_pcdev4, &platform_pcdev5
 };
 
 void pcdev_release(struct device *dev)
@@ -91,7 +115,13 @@ static int __init pcdev_platform_init(void)
     // platform_device_register(&platform_pcdev1);
     // platform_device_register(&platform_pcdev2);
 
-    int rc = platform_add_devices(plat_devices_array, ARRAY_SIZE(plat_devices_array));
+    int rc;
+
+    if (pcdev5_size <= 0)
+        return -EINVAL;
+    pcdev_pdata[4].size = pcdev5_size;
+
+    rc = platform_add_devices(plat_devices_array, ARRAY_SIZE(plat_devices_array));
     if (rc) {
         pr_err("PCD plat init failed rc: %d\n", rc);
         return rc;
@@ -109,6 +139,7 @@ static void __exit pcdev_platform_exit(void)
     platform_device_unregister(&platform_pcdev2);
     platform_device_unregister(&platform_pcdev3);
     platform_device_unregister(&platform_pcdev4);
+    platform_device_unregister(&platform_pcdev5);
     pr_info("PCD plat module unloaded\n");
 }
 
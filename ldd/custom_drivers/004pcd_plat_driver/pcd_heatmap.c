@@ -0,0 +1,243 @@
+/*
+ * Renders the access heatmap pcd_core keeps for a device.
+ *
+ * Each cell of the grid is one 4 KB region, or several summed when the device
+ * is too large to fit, shaded on a log scale against the hottest cell. The
+ * hottest regions are listed below with counts scaled back up by the sample
+ * rate, an estimate of the real number of accesses.
+ *
+ *	echo 16 > /sys/class/pcd_class/pcdev-4/heat_sample
+ *	./pcd_heatmap /sys/kernel/debug/pcd/pcdev-4/heatmap
+ *	./pcd_heatmap -m w -c 32 -t 5 /sys/kernel/debug/pcd/pcdev-4/heatmap
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "pcd_heat.h"
+
+#define MAX_ROWS	32
+
+static const char shades[] = " .:-=+*#%@";
+
+enum metric {
+	METRIC_ALL,
+	METRIC_READS,
+	METRIC_WRITES,
+};
+
+static uint64_t region_count(const struct pcd_heat_region *r, enum metric m)
+{
+	switch (m) {
+	case METRIC_READS:
+		return r->reads;
+	case METRIC_WRITES:
+		return r->writes;
+	default:
+		return (uint64_t)r->reads + r->writes;
+	}
+}
+
+static void *read_file(const char *path, size_t *len)
+{
+	size_t cap = 1 << 16, n = 0;
+	char *buf = malloc(cap), *nbuf;
+	ssize_t ret;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0 || !buf) {
+		perror(path);
+		free(buf);
+		return NULL;
+	}
+
+	/* debugfs files report no size, read until EOF */
+	while ((ret = read(fd, buf + n, cap - n)) > 0) {
+		n += ret;
+		if (n < cap)
+			continue;
+		cap *= 2;
+		nbuf = realloc(buf, cap);
+		if (!nbuf) {
+			ret = -1;
+			errno = ENOMEM;
+			break;
+		}
+		buf = nbuf;
+	}
+
+	if (ret < 0) {
+		perror(path);
+		free(buf);
+		buf = NULL;
+	}
+
+	close(fd);
+	*len = n;
+	return buf;
+}
+
+static void render_grid(const struct pcd_heat_hdr *hdr, const struct pcd_heat_region *regions,
+	unsigned int cols, enum metric m)
+{
+	uint64_t nr = hdr->nr_regions, per_cell, cells, max = 0, sum, c, i;
+	uint64_t *cell;
+	unsigned int level;
+
+	/* Merge regions until the grid fits in MAX_ROWS rows */
+	per_cell = (nr + (uint64_t)cols * MAX_ROWS - 1) / ((uint64_t)cols * MAX_ROWS);
+	if (!per_cell)
+		per_cell = 1;
+	cells = (nr + per_cell - 1) / per_cell;
+
+	cell = calloc(cells, sizeof(*cell));
+	if (!cell)
+		return;
+
+	for (c = 0; c < cells; c++) {
+		sum = 0;
+		for (i = c * per_cell; i < nr && i < (c + 1) * per_cell; i++)
+			sum += region_count(&regions[i], m);
+		cell[c] = sum;
+		if (sum > max)
+			max = sum;
+	}
+
+	printf("each cell %llu KB, hottest cell %llu sampled accesses\n\n",
+		(unsigned long long)(per_cell * hdr->region_size >> 10), (unsigned long long)max);
+
+	for (c = 0; c < cells; c++) {
+		if (c % cols == 0)
+			printf("%10llx |", (unsigned long long)(c * per_cell * hdr->region_size));
+
+		/* Log scale, a cell touched once still shows */
+		if (!cell[c])
+			level = 0;
+		else if (cell[c] == max)
+			level = sizeof(shades) - 2;
+		else
+			level = 1 + (unsigned int)(log2((double)cell[c]) / log2((double)max + 1) * (sizeof(shades) - 3));
+		putchar(shades[level]);
+
+		if (c % cols == cols - 1 || c == cells - 1)
+			printf("|\n");
+	}
+
+	free(cell);
+}
+
+static void render_top(const struct pcd_heat_hdr *hdr, const struct pcd_heat_region *regions,
+	unsigned int top, enum metric m)
+{
+	uint64_t nr = hdr->nr_regions, i, j, best;
+	uint64_t scale = hdr->sample ? hdr->sample : 1;
+	char *taken = calloc(nr, 1);
+	unsigned int n;
+
+	if (!taken)
+		return;
+
+	printf("\n%18s %14s %14s\n", "offset", "est. reads", "est. writes");
+
+	/* Selection, top is small */
+	for (n = 0; n < top; n++) {
+		best = nr;
+		for (i = 0; i < nr; i++) {
+			if (taken[i] || !region_count(&regions[i], m))
+				continue;
+			if (best == nr || region_count(&regions[i], m) > region_count(&regions[best], m))
+				best = i;
+		}
+		if (best == nr)
+			break;
+
+		taken[best] = 1;
+		j = best * hdr->region_size;
+		printf("%8llx-%-9llx %14llu %14llu\n", (unsigned long long)j,
+			(unsigned long long)(j + hdr->region_size - 1),
+			(unsigned long long)(regions[best].reads * scale),
+			(unsigned long long)(regions[best].writes * scale));
+	}
+
+	if (!n)
+		printf("%18s\n", "no accesses");
+
+	free(taken);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-m all|r|w] [-c columns] [-t top] <heatmap file>\n", prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	enum metric m = METRIC_ALL;
+	unsigned int cols = 64, top = 10;
+	const struct pcd_heat_hdr *hdr;
+	size_t len;
+	void *buf;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "m:c:t:")) != -1) {
+		switch (opt) {
+		case 'm':
+			if (!strcmp(optarg, "r"))
+				m = METRIC_READS;
+			else if (!strcmp(optarg, "w"))
+				m = METRIC_WRITES;
+			else if (!strcmp(optarg, "all"))
+				m = METRIC_ALL;
+			else
+				usage(argv[0]);
+			break;
+		case 'c':
+			cols = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			top = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || !cols)
+		usage(argv[0]);
+
+	buf = read_file(argv[optind], &len);
+	if (!buf)
+		return 1;
+
+	hdr = buf;
+	if (len < sizeof(*hdr) || hdr->magic != PCD_HEAT_MAGIC || hdr->version != PCD_HEAT_VERSION ||
+	    !hdr->region_size || len - sizeof(*hdr) < hdr->nr_regions * sizeof(struct pcd_heat_region)) {
+		fprintf(stderr, "%s: not a pcd heatmap\n", argv[optind]);
+		free(buf);
+		return 1;
+	}
+
+	printf("%llu bytes in %llu regions of %u bytes, ", (unsigned long long)hdr->dev_size,
+		(unsigned long long)hdr->nr_regions, hdr->region_size);
+	if (hdr->sample)
+		printf("sampling 1 in %u", hdr->sample);
+	else
+		printf("sampling off");
+	if (hdr->half_life_ms)
+		printf(", half life %u ms\n", hdr->half_life_ms);
+	else
+		printf(", no decay\n");
+
+	render_grid(hdr, (const struct pcd_heat_region *)(hdr + 1), cols, m);
+	render_top(hdr, (const struct pcd_heat_region *)(hdr + 1), top, m);
+
+	free(buf);
+	return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef __PCD_IOCTL_H
+#define __PCD_IOCTL_H
+
+/* Shared between the pcd platform driver and its userspace clients */
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* Header preceding every record read from a device in record mode */
+struct pcd_record_hdr {
+    __u64 ts_ns;        /* ktime_get_ns() when the record was written */
+    __u64 seq;          /* per-device sequence number, starting at 0 */
+    __u32 len;          /* payload bytes following the header */
+    __u32 reserved;
+};
+
+/* Copy len bytes from src_fd at src_off into the device the ioctl is issued on at dst_off */
+struct pcd_copy_range {
+    __s32 src_fd;
+    __u32 reserved;
+    __u64 src_off;
+    __u64 dst_off;
+    __u64 len;
+};
+
+/* Export the device memory as a dma-buf. flags takes O_CLOEXEC and an
+* access mode, O_RDONLY or O_RDWR. The dma-buf fd is returned in fd. */
+struct pcd_dmabuf_export {
+    __u32 flags;
+    __s32 fd;
+};
+
+#define PCD_IOC_MAGIC       'p'
+
+/* Record mode: position the file at the first record stamped at or after the given ns */
+#define PCD_IOC_SEEK_TS     _IOW(PCD_IOC_MAGIC, 1, __u64)
+
+/* Stream mode: returns the number of bytes copied, clamped to both device sizes */
+#define PCD_IOC_COPY        _IOW(PCD_IOC_MAGIC, 2, struct pcd_copy_range)
+
+/* Sparse devices only. Not available while checksums are enabled, they can't track
+* writes made through the dma-buf */
+#define PCD_IOC_EXPORT_DMABUF   _IOWR(PCD_IOC_MAGIC, 3, struct pcd_dmabuf_export)
+
+/* Stream mode with double_buffer set: publishes what was written since the last
+* commit, coalesced writes of this file included. Readers see either the old or
+* the new contents, never a mix. */
+#define PCD_IOC_COMMIT      _IO(PCD_IOC_MAGIC, 4)
+
+#endif /* #ifndef __PCD_IOCTL_H */
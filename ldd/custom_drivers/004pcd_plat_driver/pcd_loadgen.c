@@ -0,0 +1,327 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+#include <linux/kthread.h>
+#include <linux/cpumask.h>
+#include <linux/prandom.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/u64_stats_sync.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+
+#include "pcd_platform.h"
+
+/*
+* Load generator for the pcd platform driver. Each thread opens the device on its
+* own and loops over pcd_kernel_read()/pcd_kernel_write() until the module is
+* unloaded, so the numbers in debugfs reflect the driver alone, without syscall
+* or copy_to_user() overhead. Threads start at load time, e.g.
+*
+*   insmod pcd_loadgen.ko dev=/dev/pcdev-4 threads=4 cpus=0-3 read_pct=70 xfer_size=65536
+*   cat /sys/kernel/debug/pcd_loadgen/stats
+*   echo 1 > /sys/kernel/debug/pcd_loadgen/reset
+*/
+
+/* Format pr_info() so it prints funtion name first */
+#undef pr_fmt
+#define pr_fmt(fmt) "%s : " fmt, __func__
+
+#define PCD_LG_MAX_THREADS  (64)
+
+static char *dev = "/dev/pcdev-4";
+module_param(dev, charp, 0444);
+MODULE_PARM_DESC(dev, "pcd device node to load");
+
+static unsigned int threads = 1;
+module_param(threads, uint, 0444);
+MODULE_PARM_DESC(threads, "Number of load threads");
+
+static char *cpus = "";
+module_param(cpus, charp, 0444);
+MODULE_PARM_DESC(cpus, "CPU list the threads are spread over round robin, empty to leave them unbound");
+
+static unsigned int read_pct = 50;
+module_param(read_pct, uint, 0444);
+MODULE_PARM_DESC(read_pct, "Percentage of operations that are reads, the rest are writes");
+
+static unsigned int xfer_size = 4096;
+module_param(xfer_size, uint, 0444);
+MODULE_PARM_DESC(xfer_size, "Bytes per operation");
+
+/* Counters are only written by the owning thread, u64_stats keeps them
+* consistent for the debugfs reader on 32 bit */
+struct pcd_lg_thread {
+    struct task_struct *task;
+    struct file *fh;
+    void *buf;
+    loff_t size;
+    struct rnd_state rnd;
+    struct u64_stats_sync syncp;
+    u64_stats_t ops;
+    u64_stats_t bytes;
+    u64_stats_t errors;
+};
+
+struct pcd_lg_totals {
+    u64 ops;
+    u64 bytes;
+    u64 errors;
+};
+
+struct pcd_lg_data {
+    unsigned int nr_threads;
+    struct pcd_lg_thread *threads;
+    struct dentry *dir;
+    /* Counter values and time at the last reset, under stats_lock */
+    struct mutex stats_lock;
+    struct pcd_lg_totals base;
+    u64 base_ns;
+};
+
+static struct pcd_lg_data lg_data;
+
+static int pcd_lg_thread_fn(void *arg)
+{
+    struct pcd_lg_thread *t = arg;
+    loff_t pos = 0;
+    size_t len = min_t(loff_t, xfer_size, t->size);
+    ssize_t ret;
+
+    while (!kthread_should_stop()) {
+        if (pos + len > t->size)
+            pos = 0;
+
+        if (prandom_u32_state(&t->rnd) % 100 < read_pct)
+            ret = pcd_kernel_read(t->fh, t->buf, len, &pos);
+        else
+            ret = pcd_kernel_write(t->fh, t->buf, len, &pos);
+
+        u64_stats_update_begin(&t->syncp);
+        if (ret < 0) {
+            u64_stats_inc(&t->errors);
+        } else {
+            u64_stats_inc(&t->ops);
+            u64_stats_add(&t->bytes, ret);
+        }
+        u64_stats_update_end(&t->syncp);
+
+        cond_resched();
+    }
+
+    return 0;
+}
+
+static void pcd_lg_sum(struct pcd_lg_totals *sum)
+{
+    unsigned int i, start;
+    struct pcd_lg_thread *t;
+    struct pcd_lg_totals snap;
+
+    memset(sum, 0, sizeof(*sum));
+
+    for (i = 0; i < lg_data.nr_threads; i++) {
+        t = &lg_data.threads[i];
+        do {
+            start = u64_stats_fetch_begin(&t->syncp);
+            snap.ops = u64_stats_read(&t->ops);
+            snap.bytes = u64_stats_read(&t->bytes);
+            snap.errors = u64_stats_read(&t->errors);
+        } while (u64_stats_fetch_retry(&t->syncp, start));
+
+        sum->ops += snap.ops;
+        sum->bytes += snap.bytes;
+        sum->errors += snap.errors;
+    }
+}
+
+static int stats_show(struct seq_file *s, void *unused)
+{
+    struct pcd_lg_totals sum;
+    u64 elapsed_ns;
+
+    mutex_lock(&lg_data.stats_lock);
+    pcd_lg_sum(&sum);
+    sum.ops -= lg_data.base.ops;
+    sum.bytes -= lg_data.base.bytes;
+    sum.errors -= lg_data.base.errors;
+    elapsed_ns = ktime_get_ns() - lg_data.base_ns;
+    mutex_unlock(&lg_data.stats_lock);
+
+    if (!elapsed_ns)
+        elapsed_ns = 1;
+
+    seq_printf(s, "threads: %u\n", lg_data.nr_threads);
+    seq_printf(s, "elapsed_ms: %llu\n", div_u64(elapsed_ns, NSEC_PER_MSEC));
+    seq_printf(s, "ops: %llu\n", sum.ops);
+    seq_printf(s, "bytes: %llu\n", sum.bytes);
+    seq_printf(s, "errors: %llu\n", sum.errors);
+    seq_printf(s, "ops_per_sec: %llu\n", mul_u64_u64_div_u64(sum.ops, NSEC_PER_SEC, elapsed_ns));
+    seq_printf(s, "bytes_per_sec: %llu\n", mul_u64_u64_div_u64(sum.bytes, NSEC_PER_SEC, elapsed_ns));
+
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(stats);
+
+/* Any write restarts the measurement window, e.g. to drop the warm up */
+static ssize_t reset_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
+{
+    mutex_lock(&lg_data.stats_lock);
+    pcd_lg_sum(&lg_data.base);
+    lg_data.base_ns = ktime_get_ns();
+    mutex_unlock(&lg_data.stats_lock);
+
+    return count;
+}
+
+static const struct file_operations reset_fops = {
+    .owner = THIS_MODULE,
+    .write = reset_write,
+};
+
+static void pcd_lg_stop(void)
+{
+    unsigned int i;
+    struct pcd_lg_thread *t;
+
+    for (i = 0; i < lg_data.nr_threads; i++) {
+        t = &lg_data.threads[i];
+        if (t->task)
+            kthread_stop(t->task);
+        if (!IS_ERR_OR_NULL(t->fh))
+            filp_close(t->fh, NULL);
+        kfree(t->buf);
+    }
+
+    kfree(lg_data.threads);
+}
+
+static int pcd_lg_start_thread(struct pcd_lg_thread *t, unsigned int id, int flags)
+{
+    t->fh = filp_open(dev, flags, 0);
+    if (IS_ERR(t->fh)) {
+        pr_err("Could not open %s\n", dev);
+        return PTR_ERR(t->fh);
+    }
+
+    /* pcd_llseek() reports the device size for SEEK_END. Rings can't seek and
+    ignore the offset, any size will do there */
+    t->size = vfs_llseek(t->fh, 0, SEEK_END);
+    if (t->size == -ESPIPE)
+        t->size = xfer_size;
+    if (t->size <= 0) {
+        pr_err("Could not size %s\n", dev);
+        return t->size ? t->size : -EINVAL;
+    }
+
+    t->buf = kmalloc(min_t(loff_t, xfer_size, t->size), GFP_KERNEL);
+    if (!t->buf)
+        return -ENOMEM;
+
+    memset(t->buf, 0xa5, min_t(loff_t, xfer_size, t->size));
+    prandom_seed_state(&t->rnd, get_random_u64());
+    u64_stats_init(&t->syncp);
+
+    t->task = kthread_create(pcd_lg_thread_fn, t, "pcd_loadgen/%u", id);
+    if (IS_ERR(t->task)) {
+        int rc = PTR_ERR(t->task);
+
+        t->task = NULL;
+        return rc;
+    }
+
+    return 0;
+}
+
+static int __init pcd_lg_init(void)
+{
+    int rc, flags;
+    unsigned int i, cpu;
+    cpumask_var_t mask;
+
+    if (!threads || threads > PCD_LG_MAX_THREADS || !xfer_size || read_pct > 100) {
+        pr_err("Invalid load parameters\n");
+        return -EINVAL;
+    }
+
+    if (!zalloc_cpumask_var(&mask, GFP_KERNEL))
+        return -ENOMEM;
+
+    /* 1. Resolve the CPU list */
+    if (*cpus) {
+        rc = cpulist_parse(cpus, mask);
+        if (rc)
+            goto free_mask;
+        cpumask_and(mask, mask, cpu_online_mask);
+        if (cpumask_empty(mask)) {
+            pr_err("No online CPU in %s\n", cpus);
+            rc = -EINVAL;
+            goto free_mask;
+        }
+    }
+
+    /* 2. Open the device and create the threads, only ask for the access the mix needs.
+    A ring that is empty or full fails the op with -EAGAIN instead of blocking kthread_stop() */
+    lg_data.threads = kcalloc(threads, sizeof(*lg_data.threads), GFP_KERNEL);
+    if (!lg_data.threads) {
+        rc = -ENOMEM;
+        goto free_mask;
+    }
+    lg_data.nr_threads = threads;
+
+    flags = (read_pct == 100 ? O_RDONLY : read_pct == 0 ? O_WRONLY : O_RDWR) | O_NONBLOCK;
+
+    for (i = 0; i < threads; i++) {
+        rc = pcd_lg_start_thread(&lg_data.threads[i], i, flags);
+        if (rc)
+            goto stop;
+    }
+
+    /* 3. Stats */
+    mutex_init(&lg_data.stats_lock);
+    lg_data.base_ns = ktime_get_ns();
+    lg_data.dir = debugfs_create_dir("pcd_loadgen", NULL);
+    debugfs_create_file("stats", 0444, lg_data.dir, NULL, &stats_fops);
+    debugfs_create_file("reset", 0200, lg_data.dir, NULL, &reset_fops);
+
+    /* 4. Bind and go */
+    cpu = cpumask_first(mask);
+    for (i = 0; i < threads; i++) {
+        if (*cpus) {
+            set_cpus_allowed_ptr(lg_data.threads[i].task, cpumask_of(cpu));
+            cpu = cpumask_next(cpu, mask);
+            if (cpu >= nr_cpu_ids)
+                cpu = cpumask_first(mask);
+        }
+        wake_up_process(lg_data.threads[i].task);
+    }
+
+    free_cpumask_var(mask);
+
+    pr_info("PCD loadgen started %u threads on %s, %u%% reads of %u bytes\n", threads, dev, read_pct, xfer_size);
+
+    return 0;
+
+stop:
+    pcd_lg_stop();
+free_mask:
+    free_cpumask_var(mask);
+    return rc;
+}
+
+static void __exit pcd_lg_exit(void)
+{
+    debugfs_remove_recursive(lg_data.dir);
+    pcd_lg_stop();
+
+    pr_info("PCD loadgen stopped\n");
+}
+
+module_init(pcd_lg_init);
+module_exit(pcd_lg_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Kieran");
+MODULE_DESCRIPTION("In-kernel load generator for the pcd platform driver");
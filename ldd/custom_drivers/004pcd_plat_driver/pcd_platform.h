@@ -1,18 +1,20 @@
 #ifndef __PCD_PLATFORM_H
 #define __PCD_PLATFORM_H
 
-#define PCD_DEVICE_NAME     "pcddev-"
+#include "pcd_core.h"
 
-enum {
-    PERM_RDONLY = 0x1,
-    PERM_WRONLY = 0x10,
-    PERM_RDWR = 0x11,
-};
+#define PCD_DEVICE_NAME     "pcddev-"
 
 struct pcdev_platform_data {
     int size;
     int perm;
+    enum pcd_backend backend;
     const char *sn;
 };
 
+/* Exported by pcd_platform_driver for in-kernel users such as pcd_loadgen.
+* The file must be a stream mode pcd device opened with filp_open(). */
+ssize_t pcd_kernel_read(struct file *fh, void *buf, size_t count, loff_t *f_pos);
+ssize_t pcd_kernel_write(struct file *fh, const void *buf, size_t count, loff_t *f_pos);
+
 #endif /* #ifndef __PCD_PLATFORM_H */
\ No newline at end of file
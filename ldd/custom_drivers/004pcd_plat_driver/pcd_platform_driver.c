@@ -4,18 +4,56 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/mod_devicetable.h>
+#include <linux/mutex.h>
 #include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/xarray.h>
+#include <linux/workqueue.h>
+#include <linux/file.h>
+#include <linux/dma-buf.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
 #include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/idr.h>
+#include <linux/configfs.h>
 
 #include <linux/platform_device.h>
 
 #include "pcd_platform.h"
+#include "pcd_ioctl.h"
 
 /* Format pr_info() so it prints funtion name first */
 #undef pr_fmt
 #define pr_fmt(fmt) "%s : " fmt, __func__
 
-#define MAX_N_DEVICES 2
+#define MAX_N_DEVICES 5
+
+/* Minors 0 to MAX_N_DEVICES - 1 belong to the platform devices, configfs created
+* devices take the rest */
+#define PCD_MAX_MINORS  (256)
+#define PCD_SN_LEN      (32)
+
+/* Largest per-open write coalescing buffer and the default commit delay */
+#define PCD_WB_MAX_SIZE         (1 << 20)
+#define PCD_WB_DELAY_MS         (10)
+
+/* Largest buffer a configfs created device may ask for */
+#define PCD_CFS_MAX_SIZE        (64 << 20)
+
+/* Record mode keeps records 8 byte aligned and indexes every PCD_REC_IDX_STRIDE'th one */
+#define PCD_REC_ALIGN       (8)
+#define PCD_REC_IDX_STRIDE  (16)
+
+/* Keep a CRC32C per block of each buffer, verified on read and by the scrubber */
+static bool crc_enable;
+module_param(crc_enable, bool, 0444);
+MODULE_PARM_DESC(crc_enable, "Maintain per-block CRC32C checksums of device buffers");
+
+/* The scrubber verifies this much per run and drops pcd.lock in between */
+#define PCD_SCRUB_CHUNK     (64 * 1024)
+
+static unsigned int scrub_interval_ms;
 
 /* prototypes */
 static int pcd_open(struct inode *inode, struct file *fh);
@@ -23,24 +61,77 @@ static int pcd_release(struct inode *inode, struct file *fh);
 static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos);
 static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos);
 static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence);
+static long pcd_ioctl(struct file *fh, unsigned int cmd, unsigned long arg);
+static int pcd_flush(struct file *fh, fl_owner_t id);
+static int pcd_fsync(struct file *fh, loff_t start, loff_t end, int datasync);
 
 static int pcd_plt_drv_probe(struct platform_device *dev);
 static int pcd_plt_drv_remove(struct platform_device *dev);
 
 /* PCD driver data - statically alloc */
 struct pcddrv_priv_data {
-    int total_devices;
+    atomic_t total_devices;     /* platform probe and configfs run under different locks */
     dev_t dev_num_base;
     struct class *class_pcd;
-    struct device *device_pcd;
+    struct ida minors;
+};
+
+/* Sparse time index entry of a record mode device */
+struct pcd_rec_idx {
+    u64 ts_ns;
+    u32 off;
 };
 
-/* PCD device data - dynamic alloc with device creation */
+/* PCD device data - dynamic alloc with device creation. The buffer, its lock
+* and checksums live in pcd, shared with the other pcd drivers via pcd_core */
 struct pcdev_priv_data {
-    struct pcdev_platform_data pdata;
-    char *buf;
+    struct pcd_dev pcd;
     dev_t dev_num;
+    struct device dev;
     struct cdev cdev;
+    struct delayed_work scrub_work;
+    loff_t scrub_pos;
+    int open_count;
+    /* Record mode, the mode only changes while the device is not open */
+    bool record_mode;
+    u32 rec_tail;
+    u64 rec_seq;
+    struct pcd_rec_idx *rec_idx;
+    u32 rec_idx_len;
+    /* Write coalescing, the buffer size is picked up by files opened after it is set */
+    unsigned int wb_size;
+    unsigned int wb_delay_ms;
+    atomic_long_t wb_writes;
+    atomic_long_t wb_commits;
+};
+
+/* Per-open data. With coalescing on, small contiguous writes collect in wb_buf
+* and reach the device buffer as one write at wb_pos */
+struct pcd_file {
+    struct pcdev_priv_data *dev_data;
+    struct pcd_client client;
+    struct mutex wb_lock;
+    char *wb_buf;
+    size_t wb_size;
+    size_t wb_len;
+    loff_t wb_pos;
+    int wb_err;
+    struct delayed_work wb_work;
+};
+
+/* An exported dma-buf holds its own reference on every page of the device */
+struct pcd_dmabuf {
+    struct page **pages;
+    unsigned long nr_pages;
+    struct mutex lock;
+    struct list_head attachments;
+};
+
+struct pcd_dmabuf_attachment {
+    struct device *dev;
+    struct sg_table sgt;
+    bool mapped;
+    struct list_head node;
 };
 
 struct pcddrv_priv_data pcdrv_data;
@@ -51,7 +142,11 @@ static struct file_operations pcd_fops = {
     .llseek = pcd_llseek,
     .read = pcd_read,
     .write = pcd_write,
+    .unlocked_ioctl = pcd_ioctl,
+    .compat_ioctl = compat_ptr_ioctl,
     .open = pcd_open,
+    .flush = pcd_flush,
+    .fsync = pcd_fsync,
     .release = pcd_release
 };
 
@@ -66,7 +161,8 @@ enum pcdev_names {
     PCDEVA1x = 0,
     PCDEVB1x,
     PCDEVC1x,
-    PCDEVD1x
+    PCDEVD1x,
+    PCDEVE1x
 };
 
 static struct device_config dev_cfgs[] = {
@@ -74,13 +170,16 @@ static struct device_config dev_cfgs[] = {
     [PCDEVB1x] = {.cfg_item1 = 50, .cfg_item2 = 22},
     [PCDEVC1x] = {.cfg_item1 = 40, .cfg_item2 = 23},
     [PCDEVD1x] = {.cfg_item1 = 30, .cfg_item2 = 24},
+    [PCDEVE1x] = {.cfg_item1 = 20, .cfg_item2 = 25},
 };
 
 static const struct platform_device_id plt_devs_ids[] = {
     [0] = {.name = PCD_DEVICE_NAME "A1x", .driver_data = PCDEVA1x},
     [1] = {.name = PCD_DEVICE_NAME "B1x", .driver_data = PCDEVB1x},
     [2] = {.name = PCD_DEVICE_NAME "C1x", .driver_data = PCDEVC1x},
-    [3] = {.name = PCD_DEVICE_NAME "D1x", .driver_data = PCDEVD1x}
+    [3] = {.name = PCD_DEVICE_NAME "D1x", .driver_data = PCDEVD1x},
+    [4] = {.name = PCD_DEVICE_NAME "E1x", .driver_data = PCDEVE1x},
+    { }
 };
 
 static struct platform_driver pcdev_plt_drv = {
@@ -92,205 +191,1870 @@ static struct platform_driver pcdev_plt_drv = {
     }
 };
 
-static int check_permission(int dev_perm, int acc_mode)
+/* Periodically verify the whole buffer so corruption of cold data is caught too.
+* Each run verifies one chunk from scrub_pos, the next chunk is queued right away
+* and a new pass starts scrub_interval_ms after the last one ended. */
+static void pcd_crc_scrub(struct work_struct *work)
 {
-    if (dev_perm == PERM_RDWR)
-        return 0;
-    
-    if (dev_perm == PERM_RDONLY && (acc_mode & FMODE_READ) && !(acc_mode & FMODE_WRITE))
-        return 0;
-    
-    if (dev_perm == PERM_WRONLY && !(acc_mode & FMODE_READ) && (acc_mode & FMODE_WRITE))
-        return 0;
+    struct pcdev_priv_data *dev_data = container_of(to_delayed_work(work), struct pcdev_priv_data, scrub_work);
+    unsigned interval = READ_ONCE(scrub_interval_ms);
+    size_t len;
+    loff_t pos;
+
+    if (!interval)
+        return;
+
+    mutex_lock(&dev_data->pcd.lock);
+    pos = dev_data->scrub_pos;
+    len = min_t(size_t, PCD_SCRUB_CHUNK, dev_data->pcd.size - pos);
+    pcd_crc_verify(&dev_data->pcd, pos, len);
+    pos += len;
+    if (pos >= dev_data->pcd.size)
+        pos = 0;
+    dev_data->scrub_pos = pos;
+    mutex_unlock(&dev_data->pcd.lock);
 
-    return -EPERM;
+    schedule_delayed_work(&dev_data->scrub_work, pos ? 0 : msecs_to_jiffies(interval));
 }
 
-static int pcd_open(struct inode *inode, struct file *fh)
+static int pcd_crc_scrub_kick(struct device *dev, void *data)
 {
-    pr_info("PCD Device open called\n");
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    if (dev_data->pcd.crc)
+        mod_delayed_work(system_wq, &dev_data->scrub_work, 0);
+
     return 0;
 }
 
-/* Only called when references to driver count reaches 0
-* so not necessarily called on close(). */
-static int pcd_release(struct inode *inode, struct file *fh)
+/* Kick the scrubber of every device when switched on or the period changes, a
+* device probed while it was 0 never queued its work */
+static int pcd_scrub_interval_set(const char *val, const struct kernel_param *kp)
 {
-    pr_info("PCD Device release called\n");
-    return 0;
+    int rc = param_set_uint(val, kp);
+
+    if (!rc && scrub_interval_ms && pcdrv_data.class_pcd)
+        class_for_each_device(pcdrv_data.class_pcd, NULL, NULL, pcd_crc_scrub_kick);
+
+    return rc;
 }
 
-static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos)
+static const struct kernel_param_ops pcd_scrub_interval_ops = {
+    .set = pcd_scrub_interval_set,
+    .get = param_get_uint,
+};
+
+module_param_cb(scrub_interval_ms, &pcd_scrub_interval_ops, &scrub_interval_ms, 0644);
+MODULE_PARM_DESC(scrub_interval_ms, "Period of the background checksum scrub, 0 to disable");
+
+static int pcd_dev_crc_init(struct pcdev_priv_data *dev_data)
 {
-    pr_info("PCD Device read called for %zu bytes cur f_pos=%lld\n", count, *f_pos);
+    int rc;
+
+    if (!crc_enable)
+        return 0;
+
+    rc = pcd_crc_init(&dev_data->pcd);
+    if (rc)
+        return rc;
+
+    /* Rings are left without checksums */
+    if (dev_data->pcd.crc && scrub_interval_ms)
+        schedule_delayed_work(&dev_data->scrub_work, msecs_to_jiffies(scrub_interval_ms));
+
     return 0;
 }
 
-static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
+static struct pcdev_priv_data *pcd_fh_dev(struct file *fh)
 {
-    pr_info("PCD Device write called for %zu bytes cur f_pos=%lld\n", count, *f_pos);
+    return ((struct pcd_file *)fh->private_data)->dev_data;
+}
 
-    return -ENOMEM;
+/* Record mode. Each write() appends one record to the buffer, a header
+* followed by the payload, and read() only ever returns whole records.
+* Timestamps never decrease so the sparse index can be binary searched.
+* The file position always sits on a record boundary: it only moves through
+* read(), write(), pcd_rec_llseek() and PCD_IOC_SEEK_TS, pread() and pwrite()
+* are refused at open. write() appends wherever the position is. */
+
+static u32 pcd_rec_size(u32 len)
+{
+    return ALIGN(sizeof(struct pcd_record_hdr) + len, PCD_REC_ALIGN);
 }
 
-static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence)
+/* Switch between byte stream and record mode, the buffer starts out empty either way */
+static int pcd_rec_set_mode(struct pcdev_priv_data *dev_data, bool record_mode)
 {
-    pr_info("PCD Device seek called cur f_pos=%lld + %lld\n", fh->f_pos, f_pos);
+    struct pcd_rec_idx *idx = NULL;
+    size_t n_idx;
+
+    /* Records are laid out at fixed offsets, a ring moves its contents around */
+    if (record_mode && !dev_data->pcd.ops->seekable)
+        return -EINVAL;
+
+    if (record_mode) {
+        n_idx = DIV_ROUND_UP(dev_data->pcd.size / sizeof(struct pcd_record_hdr), PCD_REC_IDX_STRIDE);
+        idx = kvcalloc(n_idx, sizeof(*idx), GFP_KERNEL);
+        if (!idx)
+            return -ENOMEM;
+    }
+
+    mutex_lock(&dev_data->pcd.lock);
+
+    /* Record reads bypass the committed version, the two modes do not mix */
+    if (dev_data->open_count || (record_mode && dev_data->pcd.db_buf)) {
+        mutex_unlock(&dev_data->pcd.lock);
+        kvfree(idx);
+        return -EBUSY;
+    }
+
+    kvfree(dev_data->rec_idx);
+    dev_data->rec_idx = idx;
+    dev_data->rec_idx_len = 0;
+    dev_data->rec_tail = 0;
+    dev_data->rec_seq = 0;
+    dev_data->record_mode = record_mode;
+    dev_data->pcd.db_blocked = record_mode;
+
+    pcd_core_clear(&dev_data->pcd);
+
+    mutex_unlock(&dev_data->pcd.lock);
+
     return 0;
 }
 
-/* Called when matched platform device is found */
-static int pcd_plt_drv_probe(struct platform_device *dev)
+static ssize_t pcd_rec_read(struct pcdev_priv_data *dev_data, char __user *buf, size_t count, loff_t *f_pos)
 {
-    int rc;
-    struct pcdev_priv_data *dev_data;
-    struct pcdev_platform_data *pdata;
+    int rc = 0;
+    size_t done = 0;
+    loff_t pos = *f_pos;
+    struct pcd_record_hdr hdr;
 
-    pr_info("PCD Device detected\n");
-    
-    /* 1. Get platform data */
-    pdata = (struct pcdev_platform_data*)dev_get_platdata(&dev->dev);
-    if (!pdata) {
-        pr_err("No platform data available\n");
-        rc = -EINVAL;
-        goto out;
+    mutex_lock(&dev_data->pcd.lock);
+
+    while (pos < dev_data->rec_tail) {
+        rc = pcd_crc_verify(&dev_data->pcd, pos, sizeof(hdr));
+        if (rc)
+            break;
+
+        pcd_mem_read(&dev_data->pcd, pos, &hdr, sizeof(hdr));
+        if (hdr.len > dev_data->rec_tail - pos - sizeof(hdr)) {
+            rc = -EIO;
+            break;
+        }
+
+        /* Records are never split, like /dev/kmsg the first one has to fit */
+        if (sizeof(hdr) + hdr.len > count - done) {
+            if (!done)
+                rc = -EINVAL;
+            break;
+        }
+
+        rc = pcd_crc_verify(&dev_data->pcd, pos, pcd_rec_size(hdr.len));
+        if (rc)
+            break;
+
+        if (pcd_mem_to_user(&dev_data->pcd, pos, buf + done, sizeof(hdr) + hdr.len)) {
+            rc = -EFAULT;
+            break;
+        }
+
+        done += sizeof(hdr) + hdr.len;
+        pos += pcd_rec_size(hdr.len);
     }
 
-    /* 2. Dynamically alloc memory for device private data */
-    dev_data = devm_kzalloc(&dev->dev, sizeof(*dev_data), GFP_KERNEL);
-    if (!dev_data) {
-        pr_err("No slab space available\n");
-        rc = -ENOMEM;
-        goto out;
+    mutex_unlock(&dev_data->pcd.lock);
+
+    if (!done)
+        return rc;
+
+    *f_pos = pos;
+
+    return done;
+}
+
+static ssize_t pcd_rec_write(struct pcdev_priv_data *dev_data, const char __user *buf, size_t count, loff_t *f_pos)
+{
+    u32 tail, need;
+    struct pcd_record_hdr hdr = { 0 };
+
+    if (!count)
+        return 0;
+
+    if (count > dev_data->pcd.size - sizeof(hdr))
+        return -EMSGSIZE;
+
+    need = pcd_rec_size(count);
+
+    mutex_lock(&dev_data->pcd.lock);
+
+    tail = dev_data->rec_tail;
+    if (need > dev_data->pcd.size - tail) {
+        mutex_unlock(&dev_data->pcd.lock);
+        return -ENOSPC;
     }
 
-    dev_data->pdata.size = pdata->size;
-    dev_data->pdata.perm = pdata->perm;
-    dev_data->pdata.sn = pdata->sn;
-    pr_info("Dev SN = %s\n", dev_data->pdata.sn);
-    pr_info("Dev size = %d\n", dev_data->pdata.size);
-    pr_info("Dev perm = %d\n", dev_data->pdata.perm);
+    if (pcd_mem_reserve(&dev_data->pcd, tail, need)) {
+        mutex_unlock(&dev_data->pcd.lock);
+        return -ENOMEM;
+    }
 
-    pr_info("cfg1 = %d\n", dev_cfgs[dev->id_entry->driver_data].cfg_item1);
-    pr_info("cfg2 = %d\n", dev_cfgs[dev->id_entry->driver_data].cfg_item2);
+    /* The record only becomes visible once the tail moves past it */
+    if (pcd_mem_from_user(&dev_data->pcd, tail + sizeof(hdr), buf, count)) {
+        pcd_crc_update(&dev_data->pcd, tail, need);
+        mutex_unlock(&dev_data->pcd.lock);
+        return -EFAULT;
+    }
 
-    /* Set the allocated dev_data field to driver data field of platform device
-    so it can be accessed in removed function to free data later */
-    dev->dev.driver_data = dev_data;
+    hdr.ts_ns = ktime_get_ns();
+    hdr.seq = dev_data->rec_seq;
+    hdr.len = count;
+    pcd_mem_write(&dev_data->pcd, tail, &hdr, sizeof(hdr));
+    pcd_crc_update(&dev_data->pcd, tail, need);
 
-    /* 3. Dynamically alloc mem for the device buf using size info from plat data */
-    dev_data->buf = devm_kzalloc(&dev->dev, dev_data->pdata.size, GFP_KERNEL);
-    if (!dev_data->buf) {
-        pr_err("No slab space available\n");
-        rc = -ENOMEM;
-        goto dev_data_free;
+    if (!(hdr.seq % PCD_REC_IDX_STRIDE)) {
+        dev_data->rec_idx[dev_data->rec_idx_len].ts_ns = hdr.ts_ns;
+        dev_data->rec_idx[dev_data->rec_idx_len].off = tail;
+        dev_data->rec_idx_len++;
     }
 
-    /* 4. Get the device num */
-    dev_data->dev_num = pcdrv_data.dev_num_base + dev->id;
+    dev_data->rec_seq++;
+    dev_data->rec_tail = tail + need;
+    *f_pos = dev_data->rec_tail;
 
-    /* 5. Do cdev init and cdev add */
-    cdev_init(&dev_data->cdev, &pcd_fops);
-    dev_data->cdev.owner = THIS_MODULE;
+    mutex_unlock(&dev_data->pcd.lock);
 
-    rc = cdev_add(&dev_data->cdev, dev_data->dev_num, 1);
-    if (rc < 0)
-        goto free_buf;
+    return count;
+}
 
-    /* 6. Create device file for detected platform device */
-    pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd, NULL, dev_data->dev_num, NULL, "pcdev-%d", dev->id);
-    if (IS_ERR(pcdrv_data.device_pcd)) {
-        pr_err("Device create failed\n");
-        rc = PTR_ERR(pcdrv_data.device_pcd);
-        goto cdev_del;
+/* Offset of the first record stamped at or after ts_ns, or the tail if there is none */
+static u32 pcd_rec_find(struct pcdev_priv_data *dev_data, u64 ts_ns)
+{
+    u32 lo = 0, hi = dev_data->rec_idx_len, mid;
+    u32 pos = 0;
+    struct pcd_record_hdr hdr;
+
+    /* Binary search the index for the first entry at or after ts_ns ... */
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dev_data->rec_idx[mid].ts_ns < ts_ns)
+            lo = mid + 1;
+        else
+            hi = mid;
     }
 
-    pcdrv_data.total_devices++;
+    /* ... the record wanted is at most PCD_REC_IDX_STRIDE records after the one before it */
+    if (lo)
+        pos = dev_data->rec_idx[lo - 1].off;
 
-    return 0;
+    while (pos < dev_data->rec_tail) {
+        pcd_mem_read(&dev_data->pcd, pos, &hdr, sizeof(hdr));
+        if (hdr.ts_ns >= ts_ns)
+            break;
+        pos += pcd_rec_size(hdr.len);
+    }
+
+    return pos;
+}
+
+/* Only record boundaries can be seeked to: the start, the tail or staying put */
+static loff_t pcd_rec_llseek(struct file *fh, loff_t f_pos, int whence)
+{
+    struct pcdev_priv_data *dev_data = pcd_fh_dev(fh);
+
+    if (f_pos)
+        return -EINVAL;
+
+    switch(whence) {
+    case SEEK_SET:
+        fh->f_pos = 0;
+        break;
+    case SEEK_CUR:
+        break;
+    case SEEK_END:
+        mutex_lock(&dev_data->pcd.lock);
+        fh->f_pos = dev_data->rec_tail;
+        mutex_unlock(&dev_data->pcd.lock);
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return fh->f_pos;
+}
+
+/* Write coalescing. Pending data is committed when the buffer fills, when a
+* write doesn't continue it, after wb_delay_ms, before a read on the same file
+* and on flush (close) or fsync. A failed commit is reported by the next
+* write, flush or fsync, like a writeback error. */
+
+/* Called with pf->wb_lock held */
+static void pcd_wb_commit(struct pcd_file *pf)
+{
+    ssize_t ret;
+    struct kvec kv;
+    struct iov_iter iter;
+    loff_t pos = pf->wb_pos;
+    size_t done = 0;
+
+    if (!pf->wb_len)
+        return;
+
+    cancel_delayed_work(&pf->wb_work);
+
+    while (done < pf->wb_len) {
+        kv.iov_base = pf->wb_buf + done;
+        kv.iov_len = pf->wb_len - done;
+        iov_iter_kvec(&iter, ITER_SOURCE, &kv, 1, kv.iov_len);
+
+        ret = pcd_core_write_iter(&pf->dev_data->pcd, &pf->client, &iter, &pos, 0);
+        if (ret <= 0) {
+            pf->wb_err = ret ? ret : -EIO;
+            break;
+        }
+        done += ret;
+    }
+
+    atomic_long_inc(&pf->dev_data->wb_commits);
+    pf->wb_len = 0;
+}
+
+/* Commit pending data, returning the error not reported yet if asked to */
+static int pcd_wb_sync(struct pcd_file *pf, bool report)
+{
+    int rc = 0;
+
+    if (!pf->wb_buf)
+        return 0;
+
+    mutex_lock(&pf->wb_lock);
+    pcd_wb_commit(pf);
+    if (report) {
+        rc = pf->wb_err;
+        pf->wb_err = 0;
+    }
+    mutex_unlock(&pf->wb_lock);
 
-    /* 7. Error handling */
-cdev_del:
-    cdev_del(&dev_data->cdev);
-free_buf:
-    devm_kfree(&dev->dev, dev_data->buf);
-dev_data_free:
-    devm_kfree(&dev->dev, dev_data);
-out:
     return rc;
 }
 
-/* Called when device is removed from system */
-static int pcd_plt_drv_remove(struct platform_device *dev)
+static void pcd_wb_timeout(struct work_struct *work)
+{
+    struct pcd_file *pf = container_of(to_delayed_work(work), struct pcd_file, wb_work);
+
+    mutex_lock(&pf->wb_lock);
+    pcd_wb_commit(pf);
+    mutex_unlock(&pf->wb_lock);
+}
+
+static ssize_t pcd_wb_write(struct pcd_file *pf, struct iov_iter *from, loff_t *f_pos)
 {
-    /* Doing error handling from pcd_plt_drv_probe() */
-    struct pcdev_priv_data *dev_data = (struct pcdev_priv_data*)dev->dev.driver_data;
+    ssize_t ret;
+    size_t count = iov_iter_count(from);
+    loff_t pos = *f_pos;
+    struct pcdev_priv_data *dev_data = pf->dev_data;
+    unsigned int delay_ms;
 
-    /* 1. Remove device created */
-    device_destroy(pcdrv_data.class_pcd, dev_data->dev_num);
+    mutex_lock(&pf->wb_lock);
 
-    /* 2. Remove a cdev entry from the system */
-    cdev_del(&dev_data->cdev);
+    /* Only a write continuing the pending range can join it */
+    if (pf->wb_len && (pos != pf->wb_pos + pf->wb_len || count > pf->wb_size - pf->wb_len))
+        pcd_wb_commit(pf);
 
-    /* 3. Free the memory held by the device */
-    kfree(dev_data->buf);
-    kfree(dev_data);
+    ret = pf->wb_err;
+    if (ret) {
+        pf->wb_err = 0;
+        goto out;
+    }
 
-    pcdrv_data.total_devices--;
+    /* Large writes gain nothing from the extra copy */
+    if (count >= pf->wb_size) {
+        ret = pcd_core_write_iter(&dev_data->pcd, &pf->client, from, f_pos, 0);
+        goto out;
+    }
+
+    /* Same clamping as the device write, done here since the commit comes later */
+    if (pos >= dev_data->pcd.size) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    count = min_t(size_t, count, dev_data->pcd.size - pos);
+
+    /* Nothing to hold back, don't start a commit timer or count a write */
+    if (!count) {
+        ret = 0;
+        goto out;
+    }
+
+    if (copy_from_iter(pf->wb_buf + pf->wb_len, count, from) != count) {
+        ret = -EFAULT;
+        goto out;
+    }
+
+    if (!pf->wb_len) {
+        pf->wb_pos = pos;
+        delay_ms = READ_ONCE(dev_data->wb_delay_ms);
+        if (delay_ms)
+            schedule_delayed_work(&pf->wb_work, msecs_to_jiffies(delay_ms));
+    }
+    pf->wb_len += count;
+    *f_pos = pos + count;
+    atomic_long_inc(&dev_data->wb_writes);
+
+    if (pf->wb_len == pf->wb_size)
+        pcd_wb_commit(pf);
+
+    ret = count;
+
+out:
+    mutex_unlock(&pf->wb_lock);
+    return ret;
+}
+
+/* Rings have no position to coalesce against and record mode keeps one record per write */
+static int pcd_wb_init(struct pcd_file *pf, struct file *fh)
+{
+    struct pcdev_priv_data *dev_data = pf->dev_data;
+    size_t size = READ_ONCE(dev_data->wb_size);
+
+    mutex_init(&pf->wb_lock);
+    INIT_DELAYED_WORK(&pf->wb_work, pcd_wb_timeout);
+
+    if (!size || !(fh->f_mode & FMODE_WRITE) || !dev_data->pcd.ops->seekable || dev_data->record_mode)
+        return 0;
+
+    pf->wb_buf = kmalloc(size, GFP_KERNEL);
+    if (!pf->wb_buf)
+        return -ENOMEM;
+    pf->wb_size = size;
 
-    pr_info("PCD Device removed\n");
     return 0;
 }
 
-/* Init and deinit */
+static void pcd_wb_free(struct pcd_file *pf)
+{
+    if (!pf->wb_buf)
+        return;
 
-static int __init pcd_driver_init(void)
+    cancel_delayed_work_sync(&pf->wb_work);
+    pcd_wb_sync(pf, false);
+    kfree(pf->wb_buf);
+}
+
+/* sysfs attributes, the ones shared with the other pcd drivers come from pcd_core */
+
+static struct pcd_dev *to_pcd(struct device *dev)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return &dev_data->pcd;
+}
+
+static struct pcd_attr_group pcd_core_attrs;
+
+static ssize_t backend_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", pcd_backend_name(dev_data->pcd.backend));
+}
+
+static ssize_t mode_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", READ_ONCE(dev_data->record_mode) ? "record" : "stream");
+}
+
+static ssize_t mode_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
 {
     int rc;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
 
-    pr_info("PCD plat driver init\n");
+    if (sysfs_streq(buf, "record"))
+        rc = pcd_rec_set_mode(dev_data, true);
+    else if (sysfs_streq(buf, "stream"))
+        rc = pcd_rec_set_mode(dev_data, false);
+    else
+        rc = -EINVAL;
 
-    /* 1. Dynamically allocate a device num */
-    rc = alloc_chrdev_region(&pcdrv_data.dev_num_base, 0, MAX_N_DEVICES, "pcddevs");
-    if (rc < 0)
-        goto out;
+    return rc ? rc : count;
+}
 
-    /* 2. Create device class under /sys/class */
-    pcdrv_data.class_pcd = class_create("pcd_class");
-    if (IS_ERR(pcdrv_data.class_pcd)) {
-        pr_info("Class creation failed\n");
-        rc = PTR_ERR(pcdrv_data.class_pcd);
-        unregister_chrdev_region(pcdrv_data.dev_num_base, MAX_N_DEVICES);
+/* A u64 read can tear on 32-bit ARM, take the lock it is written under */
+static ssize_t records_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    u64 records;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    mutex_lock(&dev_data->pcd.lock);
+    records = dev_data->rec_seq;
+    mutex_unlock(&dev_data->pcd.lock);
+
+    return sysfs_emit(buf, "%llu\n", records);
+}
+
+static ssize_t min_resident_kb_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(dev_data->pcd.min_resident) << (PAGE_SHIFT - 10));
+}
+
+/* Pages the shrinker leaves resident however cold they are */
+static ssize_t min_resident_kb_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int rc;
+    unsigned long kb;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtoul(buf, 0, &kb);
+    if (rc)
         return rc;
-    }
 
-    /* 3. Register a platform driver */
-    platform_driver_register(&pcdev_plt_drv);
+    WRITE_ONCE(dev_data->pcd.min_resident, DIV_ROUND_UP(kb, PAGE_SIZE >> 10));
 
-    return rc;
+    return count;
+}
 
-out:
-    pr_info("PCD module insertion failed\n");
-    return rc;
+static ssize_t resident_kb_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(dev_data->pcd.resident) << (PAGE_SHIFT - 10));
 }
 
-static void __exit pcd_driver_cleanup(void)
+static ssize_t reclaimed_pages_show(struct device *dev, struct device_attribute *attr, char *buf)
 {
-    pr_info("PCD plat driver exit\n");
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(dev_data->pcd.reclaimed));
+}
+
+/* Part of resident_kb held in the dedup table, a write gives the page back to the device */
+static ssize_t shared_kb_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(dev_data->pcd.shared) << (PAGE_SHIFT - 10));
+}
+
+static ssize_t coalesce_bytes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev_data->wb_size));
+}
+
+/* Size of the per-open coalescing buffer, 0 turns coalescing off */
+static ssize_t coalesce_bytes_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int rc;
+    unsigned int size;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtouint(buf, 0, &size);
+    if (rc)
+        return rc;
+    if (size > PCD_WB_MAX_SIZE)
+        return -EINVAL;
+
+    WRITE_ONCE(dev_data->wb_size, size);
+
+    return count;
+}
+
+static ssize_t coalesce_delay_ms_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev_data->wb_delay_ms));
+}
+
+/* Longest pending data waits for a commit, 0 leaves it to the other triggers */
+static ssize_t coalesce_delay_ms_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int rc;
+    unsigned int delay_ms;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtouint(buf, 0, &delay_ms);
+    if (rc)
+        return rc;
+
+    WRITE_ONCE(dev_data->wb_delay_ms, delay_ms);
+
+    return count;
+}
+
+static ssize_t coalesced_writes_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ld\n", atomic_long_read(&dev_data->wb_writes));
+}
+
+static ssize_t coalesce_commits_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ld\n", atomic_long_read(&dev_data->wb_commits));
+}
+
+static ssize_t source_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%d\n", READ_ONCE(dev_data->pcd.src) != NULL);
+}
+
+static ssize_t source_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int rc;
+    bool on;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtobool(buf, &on);
+    if (rc)
+        return rc;
+
+    if (on) {
+        rc = pcd_src_start(&dev_data->pcd);
+        if (rc)
+            return rc;
+    } else {
+        pcd_src_stop(&dev_data->pcd);
+    }
+
+    return count;
+}
+
+static ssize_t source_rate_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev_data->pcd.src_rate));
+}
+
+static ssize_t source_rate_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int rc;
+    u32 val;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtou32(buf, 0, &val);
+    if (rc)
+        return rc;
+
+    WRITE_ONCE(dev_data->pcd.src_rate, val);
+
+    return count;
+}
+
+static ssize_t source_record_size_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev_data->pcd.src_rec_size));
+}
+
+/* Picked up the next time the source starts */
+static ssize_t source_record_size_store(struct device *dev, struct device_attribute *attr, const char *buf,
+    size_t count)
+{
+    int rc;
+    u32 val;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    rc = kstrtou32(buf, 0, &val);
+    if (rc)
+        return rc;
+
+    if (!val || val > dev_data->pcd.size)
+        return -EINVAL;
+
+    WRITE_ONCE(dev_data->pcd.src_rec_size, val);
+
+    return count;
+}
+
+static ssize_t source_payload_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", pcd_src_payload_name(READ_ONCE(dev_data->pcd.src_payload)));
+}
+
+/* Picked up the next time the source starts */
+static ssize_t source_payload_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t count)
+{
+    int payload;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    payload = pcd_src_payload_parse(buf);
+    if (payload < 0)
+        return payload;
+
+    WRITE_ONCE(dev_data->pcd.src_payload, payload);
+
+    return count;
+}
+
+/* u64, read under pcd.lock like records */
+static ssize_t source_records_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    u64 records;
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    mutex_lock(&dev_data->pcd.lock);
+    records = dev_data->pcd.src_records;
+    mutex_unlock(&dev_data->pcd.lock);
+
+    return sysfs_emit(buf, "%llu\n", records);
+}
+
+static ssize_t source_overruns_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+    struct pcdev_priv_data *dev_data = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(dev_data->pcd.src_overruns));
+}
+
+static DEVICE_ATTR_RO(backend);
+static DEVICE_ATTR_RW(mode);
+static DEVICE_ATTR_RO(records);
+static DEVICE_ATTR_RW(min_resident_kb);
+static DEVICE_ATTR_RO(resident_kb);
+static DEVICE_ATTR_RO(reclaimed_pages);
+static DEVICE_ATTR_RO(shared_kb);
+static DEVICE_ATTR_RW(coalesce_bytes);
+static DEVICE_ATTR_RW(coalesce_delay_ms);
+static DEVICE_ATTR_RO(coalesced_writes);
+static DEVICE_ATTR_RO(coalesce_commits);
+static DEVICE_ATTR_RW(source);
+static DEVICE_ATTR_RW(source_rate);
+static DEVICE_ATTR_RW(source_record_size);
+static DEVICE_ATTR_RW(source_payload);
+static DEVICE_ATTR_RO(source_records);
+static DEVICE_ATTR_RO(source_overruns);
+
+static struct attribute *pcd_dev_attrs[] = {
+    &dev_attr_backend.attr,
+    &dev_attr_mode.attr,
+    &dev_attr_records.attr,
+    &dev_attr_min_resident_kb.attr,
+    &dev_attr_resident_kb.attr,
+    &dev_attr_reclaimed_pages.attr,
+    &dev_attr_shared_kb.attr,
+    &dev_attr_coalesce_bytes.attr,
+    &dev_attr_coalesce_delay_ms.attr,
+    &dev_attr_coalesced_writes.attr,
+    &dev_attr_coalesce_commits.attr,
+    &dev_attr_source.attr,
+    &dev_attr_source_rate.attr,
+    &dev_attr_source_record_size.attr,
+    &dev_attr_source_payload.attr,
+    &dev_attr_source_records.attr,
+    &dev_attr_source_overruns.attr,
+    NULL
+};
+
+static const struct attribute_group pcd_dev_group = {
+    .attrs = pcd_dev_attrs,
+};
+
+static const struct attribute_group *pcd_dev_groups[] = {
+    &pcd_dev_group,
+    &pcd_core_attrs.group,
+    NULL
+};
+
+/* Page dedup spans all devices, its stats live under /sys/class/pcd_class */
+
+static ssize_t dedup_shared_pages_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+    struct pcd_dedup_stats st;
+
+    pcd_dedup_stats(&st);
+    return sysfs_emit(buf, "%lu\n", st.shared);
+}
+
+/* Device pages served by another page with the same data */
+static ssize_t dedup_saved_pages_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+    struct pcd_dedup_stats st;
+
+    pcd_dedup_stats(&st);
+    return sysfs_emit(buf, "%lu\n", st.mapped - st.shared);
+}
+
+static ssize_t dedup_zero_pages_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+    struct pcd_dedup_stats st;
+
+    pcd_dedup_stats(&st);
+    return sysfs_emit(buf, "%lu\n", st.zero);
+}
+
+static ssize_t dedup_cow_pages_show(const struct class *class, const struct class_attribute *attr, char *buf)
+{
+    struct pcd_dedup_stats st;
+
+    pcd_dedup_stats(&st);
+    return sysfs_emit(buf, "%lu\n", st.cow);
+}
+
+static CLASS_ATTR_RO(dedup_shared_pages);
+static CLASS_ATTR_RO(dedup_saved_pages);
+static CLASS_ATTR_RO(dedup_zero_pages);
+static CLASS_ATTR_RO(dedup_cow_pages);
+
+static const struct class_attribute *pcd_class_attrs[] = {
+    &class_attr_dedup_shared_pages,
+    &class_attr_dedup_saved_pages,
+    &class_attr_dedup_zero_pages,
+    &class_attr_dedup_cow_pages,
+};
+
+static int pcd_open(struct inode *inode, struct file *fh)
+{
+    int rc;
+    struct pcd_file *pf;
+    struct pcdev_priv_data *dev_data;
+
+    /* Get devices private data struct */
+    dev_data = container_of(inode->i_cdev, struct pcdev_priv_data, cdev);
+
+    rc = pcd_core_open(&dev_data->pcd, fh);
+
+    if (rc) {
+        pr_info("PCD Device open failed for device %s rc: %d\n", dev_data->pcd.sn, rc);
+        return rc;
+    }
+
+    pf = kzalloc(sizeof(*pf), GFP_KERNEL);
+    if (!pf)
+        return -ENOMEM;
+    pf->dev_data = dev_data;
+    pcd_client_init(&pf->client);
+
+    rc = pcd_wb_init(pf, fh);
+    if (rc) {
+        kfree(pf);
+        return rc;
+    }
+
+    /* Set private data of file handle for subsequent fh calls */
+    fh->private_data = pf;
+
+    mutex_lock(&dev_data->pcd.lock);
+    dev_data->open_count++;
+    /* An offset picked by the caller may land inside a record */
+    if (dev_data->record_mode)
+        fh->f_mode &= ~(FMODE_PREAD | FMODE_PWRITE);
+    mutex_unlock(&dev_data->pcd.lock);
+
+    pr_info("PCD Device open success for device %s\n", dev_data->pcd.sn);
+
+    return 0;
+}
+
+/* Only called when references to driver count reaches 0
+* so not necessarily called on close(). */
+static int pcd_release(struct inode *inode, struct file *fh)
+{
+    struct pcd_file *pf = fh->private_data;
+    struct pcdev_priv_data *dev_data = pf->dev_data;
+
+    pcd_wb_free(pf);
+    kfree(pf);
+
+    mutex_lock(&dev_data->pcd.lock);
+    dev_data->open_count--;
+    mutex_unlock(&dev_data->pcd.lock);
+
+    pr_info("PCD Device release called\n");
+    return 0;
+}
+
+/* Called on every close(), unlike release, so close() can report a failed commit */
+static int pcd_flush(struct file *fh, fl_owner_t id)
+{
+    return pcd_wb_sync(fh->private_data, true);
+}
+
+static int pcd_fsync(struct file *fh, loff_t start, loff_t end, int datasync)
+{
+    return pcd_wb_sync(fh->private_data, true);
+}
+
+static ssize_t pcd_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos)
+{
+    ssize_t ret;
+    struct pcd_file *pf = fh->private_data;
+    struct pcdev_priv_data *dev_data = pf->dev_data;
+    pr_info("PCD Device on dev %s read called for %zu bytes cur f_pos=%lld\n", dev_data->pcd.sn, count, *f_pos);
+
+    if (dev_data->record_mode)
+        return pcd_rec_read(dev_data, buf, count, f_pos);
+
+    /* Reads see earlier writes made through the same file */
+    pcd_wb_sync(pf, false);
+
+    ret = pcd_core_read(&dev_data->pcd, &pf->client, buf, count, f_pos, fh->f_flags);
+    if (ret > 0)
+        pr_info("PCD Device read on dev %s successfully read %zd bytes, new f_pos=%lld\n", dev_data->pcd.sn, ret, *f_pos);
+
+    return ret;
+}
+
+static ssize_t pcd_write(struct file *fh, const char __user *buf, size_t count, loff_t *f_pos)
+{
+    ssize_t ret;
+    struct iov_iter iter;
+    struct pcd_file *pf = fh->private_data;
+    struct pcdev_priv_data *dev_data = pf->dev_data;
+    pr_info("PCD Device on dev %s write called for %zu bytes cur f_pos=%lld\n", dev_data->pcd.sn, count, *f_pos);
+
+    if (dev_data->record_mode)
+        return pcd_rec_write(dev_data, buf, count, f_pos);
+
+    if (pf->wb_buf) {
+        ret = import_ubuf(ITER_SOURCE, (char __user *)buf, count, &iter);
+        if (!ret)
+            ret = pcd_wb_write(pf, &iter, f_pos);
+    } else {
+        ret = pcd_core_write(&dev_data->pcd, &pf->client, buf, count, f_pos, fh->f_flags);
+    }
+    if (ret > 0)
+        pr_info("PCD Device write on dev %s successfully wrote %zd bytes, new f_pos=%lld\n", dev_data->pcd.sn, ret, *f_pos);
+
+    return ret;
+}
+
+static loff_t pcd_llseek(struct file *fh, loff_t f_pos, int whence)
+{
+    loff_t ret;
+    struct pcdev_priv_data *dev_data = pcd_fh_dev(fh);
+    pr_info("PCD Device on dev %s seek called cur f_pos=%lld + %lld\n", dev_data->pcd.sn, fh->f_pos, f_pos);
+
+    if (dev_data->record_mode)
+        return pcd_rec_llseek(fh, f_pos, whence);
+
+    ret = pcd_core_llseek(&dev_data->pcd, fh, f_pos, whence);
+    if (ret < 0)
+        return ret;
+
+    pr_info("PCD Device %s seek new f_pos=%lld\n", dev_data->pcd.sn, fh->f_pos);
+
+    return fh->f_pos;
+}
+
+/* In-kernel access to a pcd device opened with filp_open(). Runs the same stream
+* mode path as read()/write() minus the syscall and the logging, so pcd_loadgen
+* can measure the driver on its own. O_NONBLOCK on the file applies to rings. */
+static struct pcd_file *pcd_kernel_file(struct file *fh, fmode_t mode)
+{
+    struct pcd_file *pf;
+
+    if (fh->f_op != &pcd_fops || !(fh->f_mode & mode))
+        return ERR_PTR(-EBADF);
+
+    pf = fh->private_data;
+    if (pf->dev_data->record_mode)
+        return ERR_PTR(-EINVAL);
+
+    return pf;
+}
+
+ssize_t pcd_kernel_read(struct file *fh, void *buf, size_t count, loff_t *f_pos)
+{
+    struct kvec kv = { .iov_base = buf, .iov_len = count };
+    struct iov_iter iter;
+    struct pcd_file *pf = pcd_kernel_file(fh, FMODE_READ);
+
+    if (IS_ERR(pf))
+        return PTR_ERR(pf);
+
+    pcd_wb_sync(pf, false);
+
+    iov_iter_kvec(&iter, ITER_DEST, &kv, 1, count);
+
+    return pcd_core_read_iter(&pf->dev_data->pcd, &pf->client, &iter, f_pos, fh->f_flags);
+}
+EXPORT_SYMBOL_GPL(pcd_kernel_read);
+
+ssize_t pcd_kernel_write(struct file *fh, const void *buf, size_t count, loff_t *f_pos)
+{
+    struct kvec kv = { .iov_base = (void *)buf, .iov_len = count };
+    struct iov_iter iter;
+    struct pcd_file *pf = pcd_kernel_file(fh, FMODE_WRITE);
+
+    if (IS_ERR(pf))
+        return PTR_ERR(pf);
+
+    iov_iter_kvec(&iter, ITER_SOURCE, &kv, 1, count);
+
+    if (pf->wb_buf)
+        return pcd_wb_write(pf, &iter, f_pos);
+
+    return pcd_core_write_iter(&pf->dev_data->pcd, &pf->client, &iter, f_pos, fh->f_flags);
+}
+EXPORT_SYMBOL_GPL(pcd_kernel_write);
+
+/* Move data between two pcd devices without bouncing it through userspace.
+* Issued on the destination, the source fd must be another pcd device.
+* pcd_core_copy() does the work a chunk at a time so large copies stay preemptible. */
+static long pcd_ioctl_copy(struct file *fh, struct pcd_copy_range __user *uarg)
+{
+    long rc;
+    struct fd src_fd;
+    struct pcd_copy_range req;
+    struct pcdev_priv_data *src, *dst = pcd_fh_dev(fh);
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+
+    if (req.src_off > LLONG_MAX || req.dst_off > LLONG_MAX)
+        return -EINVAL;
+
+    src_fd = fdget(req.src_fd);
+    if (!src_fd.file)
+        return -EBADF;
+
+    if (src_fd.file->f_op != &pcd_fops) {
+        rc = -EXDEV;
+        goto out;
+    }
+    src = pcd_fh_dev(src_fd.file);
+
+    if (!(src_fd.file->f_mode & FMODE_READ) || !(fh->f_mode & FMODE_WRITE)) {
+        rc = -EBADF;
+        goto out;
+    }
+
+    rc = pcd_check_permission(src->pcd.perm, FMODE_READ);
+    if (!rc)
+        rc = pcd_check_permission(dst->pcd.perm, FMODE_WRITE);
+    if (rc)
+        goto out;
+
+    if (src->record_mode || dst->record_mode) {
+        rc = -EINVAL;
+        goto out;
+    }
+
+    /* Both sides see what was written through them before the ioctl */
+    pcd_wb_sync(src_fd.file->private_data, false);
+    pcd_wb_sync(fh->private_data, false);
+
+    rc = pcd_core_copy(&dst->pcd, req.dst_off, &src->pcd, req.src_off, min_t(u64, req.len, SSIZE_MAX));
+    if (rc > 0)
+        pr_info("PCD Device copied %ld bytes from %s to %s\n", rc, src->pcd.sn, dst->pcd.sn);
+
+out:
+    fdput(src_fd);
+    return rc;
+}
+
+/* dma-buf export. The dma-buf takes its own reference on every device page so
+* it can outlive the device, and importers see the very pages read() and write()
+* use, nothing is copied. */
+
+static int pcd_dmabuf_attach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+{
+    int rc;
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+    struct pcd_dmabuf_attachment *a;
+
+    a = kzalloc(sizeof(*a), GFP_KERNEL);
+    if (!a)
+        return -ENOMEM;
+
+    rc = sg_alloc_table_from_pages(&a->sgt, pbuf->pages, pbuf->nr_pages, 0,
+        pbuf->nr_pages << PAGE_SHIFT, GFP_KERNEL);
+    if (rc) {
+        kfree(a);
+        return rc;
+    }
+
+    a->dev = attach->dev;
+    attach->priv = a;
+
+    mutex_lock(&pbuf->lock);
+    list_add(&a->node, &pbuf->attachments);
+    mutex_unlock(&pbuf->lock);
+
+    return 0;
+}
+
+static void pcd_dmabuf_detach(struct dma_buf *dmabuf, struct dma_buf_attachment *attach)
+{
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+    struct pcd_dmabuf_attachment *a = attach->priv;
+
+    mutex_lock(&pbuf->lock);
+    list_del(&a->node);
+    mutex_unlock(&pbuf->lock);
+
+    sg_free_table(&a->sgt);
+    kfree(a);
+}
+
+static struct sg_table *pcd_dmabuf_map(struct dma_buf_attachment *attach, enum dma_data_direction dir)
+{
+    int rc;
+    struct pcd_dmabuf *pbuf = attach->dmabuf->priv;
+    struct pcd_dmabuf_attachment *a = attach->priv;
+
+    rc = dma_map_sgtable(attach->dev, &a->sgt, dir, 0);
+    if (rc)
+        return ERR_PTR(rc);
+
+    mutex_lock(&pbuf->lock);
+    a->mapped = true;
+    mutex_unlock(&pbuf->lock);
+
+    return &a->sgt;
+}
+
+static void pcd_dmabuf_unmap(struct dma_buf_attachment *attach, struct sg_table *sgt, enum dma_data_direction dir)
+{
+    struct pcd_dmabuf *pbuf = attach->dmabuf->priv;
+    struct pcd_dmabuf_attachment *a = attach->priv;
+
+    mutex_lock(&pbuf->lock);
+    a->mapped = false;
+    mutex_unlock(&pbuf->lock);
+
+    dma_unmap_sgtable(attach->dev, sgt, dir, 0);
+}
+
+/* Make device writes visible to the CPU before it touches the pages ... */
+static int pcd_dmabuf_begin_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+    struct pcd_dmabuf_attachment *a;
+
+    mutex_lock(&pbuf->lock);
+    list_for_each_entry(a, &pbuf->attachments, node)
+        if (a->mapped)
+            dma_sync_sgtable_for_cpu(a->dev, &a->sgt, dir);
+    mutex_unlock(&pbuf->lock);
+
+    return 0;
+}
+
+/* ... and CPU writes visible to the devices once it is done */
+static int pcd_dmabuf_end_cpu_access(struct dma_buf *dmabuf, enum dma_data_direction dir)
+{
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+    struct pcd_dmabuf_attachment *a;
+
+    mutex_lock(&pbuf->lock);
+    list_for_each_entry(a, &pbuf->attachments, node)
+        if (a->mapped)
+            dma_sync_sgtable_for_device(a->dev, &a->sgt, dir);
+    mutex_unlock(&pbuf->lock);
+
+    return 0;
+}
+
+static int pcd_dmabuf_mmap(struct dma_buf *dmabuf, struct vm_area_struct *vma)
+{
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+
+    return vm_map_pages(vma, pbuf->pages, pbuf->nr_pages);
+}
+
+static int pcd_dmabuf_vmap(struct dma_buf *dmabuf, struct iosys_map *map)
+{
+    void *vaddr;
+    struct pcd_dmabuf *pbuf = dmabuf->priv;
+
+    vaddr = vmap(pbuf->pages, pbuf->nr_pages, VM_MAP, PAGE_KERNEL);
+    if (!vaddr)
+        return -ENOMEM;
+
+    iosys_map_set_vaddr(map, vaddr);
+    return 0;
+}
+
+static void pcd_dmabuf_vunmap(struct dma_buf *dmabuf, struct iosys_map *map)
+{
+    vunmap(map->vaddr);
+}
+
+static void pcd_dmabuf_free(struct pcd_dmabuf *pbuf)
+{
+    unsigned long i;
+
+    for (i = 0; i < pbuf->nr_pages; ++i)
+        put_page(pbuf->pages[i]);
+
+    kvfree(pbuf->pages);
+    kfree(pbuf);
+}
+
+static void pcd_dmabuf_release(struct dma_buf *dmabuf)
+{
+    pcd_dmabuf_free(dmabuf->priv);
+}
+
+static const struct dma_buf_ops pcd_dmabuf_ops = {
+    .attach = pcd_dmabuf_attach,
+    .detach = pcd_dmabuf_detach,
+    .map_dma_buf = pcd_dmabuf_map,
+    .unmap_dma_buf = pcd_dmabuf_unmap,
+    .begin_cpu_access = pcd_dmabuf_begin_cpu_access,
+    .end_cpu_access = pcd_dmabuf_end_cpu_access,
+    .mmap = pcd_dmabuf_mmap,
+    .vmap = pcd_dmabuf_vmap,
+    .vunmap = pcd_dmabuf_vunmap,
+    .release = pcd_dmabuf_release
+};
+
+static long pcd_ioctl_export(struct file *fh, struct pcd_dmabuf_export __user *uarg)
+{
+    int fd;
+    unsigned long i;
+    struct dma_buf *dmabuf;
+    struct pcd_dmabuf *pbuf;
+    struct pcd_dmabuf_export req;
+    struct pcdev_priv_data *dev_data = pcd_fh_dev(fh);
+    DEFINE_DMA_BUF_EXPORT_INFO(exp_info);
+
+    if (copy_from_user(&req, uarg, sizeof(req)))
+        return -EFAULT;
+
+    if (req.flags & ~(O_CLOEXEC | O_ACCMODE))
+        return -EINVAL;
+
+    /* The dma-buf can't grant more access than the fd it is exported from */
+    if (!(fh->f_mode & FMODE_READ))
+        return -EBADF;
+    if ((req.flags & O_ACCMODE) != O_RDONLY && !(fh->f_mode & FMODE_WRITE))
+        return -EBADF;
+
+    /* Only the sparse backend keeps its buffer in pages that can be shared */
+    if (dev_data->pcd.backend != PCD_BACKEND_SPARSE)
+        return -EOPNOTSUPP;
+
+    pcd_wb_sync(fh->private_data, false);
+
+    pbuf = kzalloc(sizeof(*pbuf), GFP_KERNEL);
+    if (!pbuf)
+        return -ENOMEM;
+
+    pbuf->nr_pages = dev_data->pcd.nr_pages;
+    pbuf->pages = kvmalloc_array(pbuf->nr_pages, sizeof(*pbuf->pages), GFP_KERNEL);
+    if (!pbuf->pages) {
+        kfree(pbuf);
+        return -ENOMEM;
+    }
+    mutex_init(&pbuf->lock);
+    INIT_LIST_HEAD(&pbuf->attachments);
+
+    mutex_lock(&dev_data->pcd.lock);
+
+    if (dev_data->pcd.crc) {
+        mutex_unlock(&dev_data->pcd.lock);
+        kvfree(pbuf->pages);
+        kfree(pbuf);
+        return -EBUSY;
+    }
+
+    /* Importers need real pages, fill in the ones never written */
+    if (pcd_mem_reserve(&dev_data->pcd, 0, dev_data->pcd.size)) {
+        mutex_unlock(&dev_data->pcd.lock);
+        kvfree(pbuf->pages);
+        kfree(pbuf);
+        return -ENOMEM;
+    }
+
+    for (i = 0; i < pbuf->nr_pages; ++i) {
+        pbuf->pages[i] = xa_load(&dev_data->pcd.pages, i);
+        get_page(pbuf->pages[i]);
+    }
+
+    mutex_unlock(&dev_data->pcd.lock);
+
+    exp_info.ops = &pcd_dmabuf_ops;
+    exp_info.size = pbuf->nr_pages << PAGE_SHIFT;
+    exp_info.flags = req.flags & O_ACCMODE;
+    exp_info.priv = pbuf;
+
+    dmabuf = dma_buf_export(&exp_info);
+    if (IS_ERR(dmabuf)) {
+        pcd_dmabuf_free(pbuf);
+        return PTR_ERR(dmabuf);
+    }
+
+    /* From here on dma_buf_put() releases the pages */
+    fd = dma_buf_fd(dmabuf, req.flags & O_CLOEXEC);
+    if (fd < 0) {
+        dma_buf_put(dmabuf);
+        return fd;
+    }
+
+    if (put_user(fd, &uarg->fd)) {
+        /* The fd is already installed, userspace can still find and close it */
+        return -EFAULT;
+    }
+
+    pr_info("PCD Device %s exported as dma-buf fd %d\n", dev_data->pcd.sn, fd);
+
+    return 0;
+}
+
+/* Only writers get to publish their writes */
+static long pcd_ioctl_commit(struct file *fh)
+{
+    int rc;
+    struct pcdev_priv_data *dev_data = pcd_fh_dev(fh);
+
+    if (!(fh->f_mode & FMODE_WRITE))
+        return -EBADF;
+
+    rc = pcd_wb_sync(fh->private_data, true);
+    if (rc)
+        return rc;
+
+    return pcd_db_commit(&dev_data->pcd);
+}
+
+static long pcd_ioctl(struct file *fh, unsigned int cmd, unsigned long arg)
+{
+    u64 ts_ns;
+    struct pcdev_priv_data *dev_data = pcd_fh_dev(fh);
+
+    switch (cmd) {
+    case PCD_IOC_SEEK_TS:
+        if (!dev_data->record_mode)
+            return -EINVAL;
+
+        if (copy_from_user(&ts_ns, (void __user *)arg, sizeof(ts_ns)))
+            return -EFAULT;
+
+        mutex_lock(&dev_data->pcd.lock);
+        fh->f_pos = pcd_rec_find(dev_data, ts_ns);
+        mutex_unlock(&dev_data->pcd.lock);
+
+        pr_info("PCD Device %s seek to ts %llu new f_pos=%lld\n", dev_data->pcd.sn, ts_ns, fh->f_pos);
+        return 0;
+    case PCD_IOC_COPY:
+        return pcd_ioctl_copy(fh, (struct pcd_copy_range __user *)arg);
+    case PCD_IOC_EXPORT_DMABUF:
+        return pcd_ioctl_export(fh, (struct pcd_dmabuf_export __user *)arg);
+    case PCD_IOC_COMMIT:
+        return pcd_ioctl_commit(fh);
+    default:
+        return -ENOTTY;
+    }
+}
+
+/* Device lifetime. A device is reference counted through its struct device, open
+* files pin it via the cdev, so its memory outlives removal until the last close. */
+
+static void pcd_dev_release(struct device *dev)
+{
+    struct pcdev_priv_data *dev_data = container_of(dev, struct pcdev_priv_data, dev);
+
+    cancel_delayed_work_sync(&dev_data->scrub_work);
+    kvfree(dev_data->rec_idx);
+    pcd_core_free(&dev_data->pcd);
+    ida_free(&pcdrv_data.minors, MINOR(dev_data->dev_num) - MINOR(pcdrv_data.dev_num_base));
+    kfree_const(dev_data->pcd.sn);
+    kfree(dev_data);
+}
+
+/* Creates /dev/pcdev-<name>. minor is the minor number to use, or -1 for any
+* free one past the platform devices. */
+static struct pcdev_priv_data *pcd_dev_create(struct device *parent, const struct pcdev_platform_data *pdata,
+    int minor, const char *name)
+{
+    int rc;
+    struct pcdev_priv_data *dev_data;
+
+    /* 1. Get the device num */
+    if (minor < 0)
+        rc = ida_alloc_range(&pcdrv_data.minors, MAX_N_DEVICES, PCD_MAX_MINORS - 1, GFP_KERNEL);
+    else
+        rc = ida_alloc_range(&pcdrv_data.minors, minor, minor, GFP_KERNEL);
+    if (rc < 0)
+        return ERR_PTR(rc);
+    minor = rc;
+
+    /* 2. Dynamically alloc memory for device private data */
+    dev_data = kzalloc(sizeof(*dev_data), GFP_KERNEL);
+    if (!dev_data) {
+        ida_free(&pcdrv_data.minors, minor);
+        return ERR_PTR(-ENOMEM);
+    }
+
+    dev_data->dev_num = pcdrv_data.dev_num_base + minor;
+    dev_data->pcd.size = pdata->size;
+    dev_data->pcd.perm = pdata->perm;
+    dev_data->wb_delay_ms = PCD_WB_DELAY_MS;
+    INIT_DELAYED_WORK(&dev_data->scrub_work, pcd_crc_scrub);
+
+    /* 3. Set up the device buf with the backend and size from plat data. There is
+    no driver provided memory here, so the static backend is refused */
+    rc = pcd_core_init(&dev_data->pcd, pdata->backend, NULL);
+    if (rc < 0) {
+        kfree(dev_data);
+        ida_free(&pcdrv_data.minors, minor);
+        return ERR_PTR(rc);
+    }
+
+    /* 4. Set up the device, from here on pcd_dev_release() cleans up */
+    device_initialize(&dev_data->dev);
+    dev_data->dev.class = pcdrv_data.class_pcd;
+    dev_data->dev.parent = parent;
+    dev_data->dev.devt = dev_data->dev_num;
+    dev_data->dev.groups = pcd_dev_groups;
+    dev_data->dev.release = pcd_dev_release;
+    dev_set_drvdata(&dev_data->dev, dev_data);
+
+    dev_data->pcd.sn = kstrdup_const(pdata->sn, GFP_KERNEL);
+    if (!dev_data->pcd.sn) {
+        rc = -ENOMEM;
+        goto put_dev;
+    }
+
+    rc = dev_set_name(&dev_data->dev, "pcdev-%s", name);
+    if (rc < 0)
+        goto put_dev;
+
+    /* 5. Checksum the initial buffer contents */
+    rc = pcd_dev_crc_init(dev_data);
+    if (rc < 0)
+        goto put_dev;
+
+    /* 6. Do cdev init and add the cdev together with its device file */
+    cdev_init(&dev_data->cdev, &pcd_fops);
+    dev_data->cdev.owner = THIS_MODULE;
+
+    rc = cdev_device_add(&dev_data->cdev, &dev_data->dev);
+    if (rc < 0) {
+        pr_err("Device create failed\n");
+        goto put_dev;
+    }
+
+    /* 7. Heatmap and other debug files */
+    pcd_core_debugfs_add(&dev_data->pcd, dev_name(&dev_data->dev));
+
+    atomic_inc(&pcdrv_data.total_devices);
+
+    return dev_data;
+
+put_dev:
+    put_device(&dev_data->dev);
+    return ERR_PTR(rc);
+}
+
+static void pcd_dev_destroy(struct pcdev_priv_data *dev_data)
+{
+    /* 1. Remove the device file and the cdev, files already open keep working.
+    The debug files go too, a new device may reuse the name before the release. */
+    cdev_device_del(&dev_data->cdev, &dev_data->dev);
+    pcd_core_debugfs_remove(&dev_data->pcd);
+
+    /* 2. Stop the checksum scrubber and the synthetic source, then drop our reference */
+    cancel_delayed_work_sync(&dev_data->scrub_work);
+    pcd_src_stop(&dev_data->pcd);
+
+    atomic_dec(&pcdrv_data.total_devices);
+
+    put_device(&dev_data->dev);
+}
+
+/* Called when matched platform device is found */
+static int pcd_plt_drv_probe(struct platform_device *dev)
+{
+    char name[12];
+    struct pcdev_priv_data *dev_data;
+    struct pcdev_platform_data *pdata;
+
+    pr_info("PCD Device detected\n");
+    
+    /* 1. Get platform data */
+    pdata = (struct pcdev_platform_data*)dev_get_platdata(&dev->dev);
+    if (!pdata) {
+        pr_err("No platform data available\n");
+        return -EINVAL;
+    }
+
+    pr_info("Dev SN = %s\n", pdata->sn);
+    pr_info("Dev size = %d\n", pdata->size);
+    pr_info("Dev perm = %d\n", pdata->perm);
+    pr_info("Dev backend = %s\n", pcd_backend_name(pdata->backend));
+
+    pr_info("cfg1 = %d\n", dev_cfgs[dev->id_entry->driver_data].cfg_item1);
+    pr_info("cfg2 = %d\n", dev_cfgs[dev->id_entry->driver_data].cfg_item2);
+
+    /* 2. Create the device, platform devices keep their id as minor and name */
+    snprintf(name, sizeof(name), "%d", dev->id);
+    dev_data = pcd_dev_create(&dev->dev, pdata, dev->id, name);
+    if (IS_ERR(dev_data))
+        return PTR_ERR(dev_data);
+
+    /* Set the allocated dev_data field to driver data field of platform device
+    so it can be accessed in removed function to free data later */
+    dev->dev.driver_data = dev_data;
+
+    return 0;
+}
+
+/* Called when device is removed from system */
+static int pcd_plt_drv_remove(struct platform_device *dev)
+{
+    pcd_dev_destroy((struct pcdev_priv_data*)dev->dev.driver_data);
+
+    pr_info("PCD Device removed\n");
+    return 0;
+}
+
+/* configfs. Devices can also be created at runtime without touching the platform data:
+*   mkdir /sys/kernel/config/pcd/foo
+*   echo 65536 > foo/size; echo rw > foo/perm; echo FOO1 > foo/sn; echo ring > foo/backend
+*   echo 1 > foo/enable     creates /dev/pcdev-foo
+*   rmdir foo               removes it again
+* The other attributes can only be changed while the device is disabled. */
+
+struct pcd_cfs_dev {
+    struct config_item item;
+    struct mutex lock;
+    struct pcdev_platform_data pdata;
+    char sn[PCD_SN_LEN];
+    struct pcdev_priv_data *dev_data;
+};
+
+static const struct {
+    int perm;
+    const char *name;
+} pcd_cfs_perms[] = {
+    { PERM_RDONLY, "ro" },
+    { PERM_WRONLY, "wo" },
+    { PERM_RDWR, "rw" },
+};
+
+static struct pcd_cfs_dev *to_pcd_cfs_dev(struct config_item *item)
+{
+    return container_of(item, struct pcd_cfs_dev, item);
+}
+
+static ssize_t pcd_cfs_size_show(struct config_item *item, char *page)
+{
+    return sysfs_emit(page, "%d\n", to_pcd_cfs_dev(item)->pdata.size);
+}
+
+static ssize_t pcd_cfs_size_store(struct config_item *item, const char *page, size_t count)
+{
+    int rc, size;
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    rc = kstrtoint(page, 0, &size);
+    if (rc)
+        return rc;
+    if (size <= 0 || size > PCD_CFS_MAX_SIZE)
+        return -EINVAL;
+
+    mutex_lock(&cfs->lock);
+    if (cfs->dev_data) {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY;
+    }
+    cfs->pdata.size = size;
+    mutex_unlock(&cfs->lock);
+
+    return count;
+}
+
+static ssize_t pcd_cfs_perm_show(struct config_item *item, char *page)
+{
+    int i;
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    for (i = 0; i < ARRAY_SIZE(pcd_cfs_perms); i++)
+        if (pcd_cfs_perms[i].perm == cfs->pdata.perm)
+            return sysfs_emit(page, "%s\n", pcd_cfs_perms[i].name);
+
+    return -EINVAL;
+}
+
+static ssize_t pcd_cfs_perm_store(struct config_item *item, const char *page, size_t count)
+{
+    int i;
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    for (i = 0; i < ARRAY_SIZE(pcd_cfs_perms); i++)
+        if (sysfs_streq(page, pcd_cfs_perms[i].name))
+            break;
+    if (i == ARRAY_SIZE(pcd_cfs_perms))
+        return -EINVAL;
+
+    mutex_lock(&cfs->lock);
+    if (cfs->dev_data) {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY;
+    }
+    cfs->pdata.perm = pcd_cfs_perms[i].perm;
+    mutex_unlock(&cfs->lock);
+
+    return count;
+}
+
+static ssize_t pcd_cfs_sn_show(struct config_item *item, char *page)
+{
+    return sysfs_emit(page, "%s\n", to_pcd_cfs_dev(item)->sn);
+}
+
+static ssize_t pcd_cfs_sn_store(struct config_item *item, const char *page, size_t count)
+{
+    size_t len = strcspn(page, "\n");
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    if (!len || len >= PCD_SN_LEN)
+        return -EINVAL;
+
+    mutex_lock(&cfs->lock);
+    if (cfs->dev_data) {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY;
+    }
+    memcpy(cfs->sn, page, len);
+    cfs->sn[len] = '\0';
+    mutex_unlock(&cfs->lock);
+
+    return count;
+}
+
+static ssize_t pcd_cfs_backend_show(struct config_item *item, char *page)
+{
+    return sysfs_emit(page, "%s\n", pcd_backend_name(to_pcd_cfs_dev(item)->pdata.backend));
+}
+
+/* linear, sparse or ring. static needs memory from the driver and isn't offered */
+static ssize_t pcd_cfs_backend_store(struct config_item *item, const char *page, size_t count)
+{
+    int backend;
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    backend = pcd_backend_parse(page);
+    if (backend < 0 || backend == PCD_BACKEND_STATIC)
+        return -EINVAL;
+
+    mutex_lock(&cfs->lock);
+    if (cfs->dev_data) {
+        mutex_unlock(&cfs->lock);
+        return -EBUSY;
+    }
+    cfs->pdata.backend = backend;
+    mutex_unlock(&cfs->lock);
+
+    return count;
+}
+
+static ssize_t pcd_cfs_enable_show(struct config_item *item, char *page)
+{
+    return sysfs_emit(page, "%d\n", !!to_pcd_cfs_dev(item)->dev_data);
+}
+
+static ssize_t pcd_cfs_enable_store(struct config_item *item, const char *page, size_t count)
+{
+    int rc;
+    bool enable;
+    struct pcdev_priv_data *dev_data;
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    rc = kstrtobool(page, &enable);
+    if (rc)
+        return rc;
+
+    mutex_lock(&cfs->lock);
+
+    if (enable && !cfs->dev_data) {
+        dev_data = pcd_dev_create(NULL, &cfs->pdata, -1, config_item_name(item));
+        if (IS_ERR(dev_data)) {
+            mutex_unlock(&cfs->lock);
+            return PTR_ERR(dev_data);
+        }
+        cfs->dev_data = dev_data;
+    } else if (!enable && cfs->dev_data) {
+        pcd_dev_destroy(cfs->dev_data);
+        cfs->dev_data = NULL;
+    }
+
+    mutex_unlock(&cfs->lock);
+
+    return count;
+}
+
+CONFIGFS_ATTR(pcd_cfs_, size);
+CONFIGFS_ATTR(pcd_cfs_, perm);
+CONFIGFS_ATTR(pcd_cfs_, sn);
+CONFIGFS_ATTR(pcd_cfs_, backend);
+CONFIGFS_ATTR(pcd_cfs_, enable);
+
+static struct configfs_attribute *pcd_cfs_attrs[] = {
+    &pcd_cfs_attr_size,
+    &pcd_cfs_attr_perm,
+    &pcd_cfs_attr_sn,
+    &pcd_cfs_attr_backend,
+    &pcd_cfs_attr_enable,
+    NULL,
+};
+
+static void pcd_cfs_release(struct config_item *item)
+{
+    kfree(to_pcd_cfs_dev(item));
+}
+
+static struct configfs_item_operations pcd_cfs_item_ops = {
+    .release = pcd_cfs_release,
+};
+
+static const struct config_item_type pcd_cfs_dev_type = {
+    .ct_item_ops = &pcd_cfs_item_ops,
+    .ct_attrs = pcd_cfs_attrs,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct config_item *pcd_cfs_make_item(struct config_group *group, const char *name)
+{
+    struct pcd_cfs_dev *cfs;
+
+    cfs = kzalloc(sizeof(*cfs), GFP_KERNEL);
+    if (!cfs)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_init(&cfs->lock);
+    cfs->pdata.size = PAGE_SIZE;
+    cfs->pdata.perm = PERM_RDWR;
+    cfs->pdata.backend = PCD_BACKEND_SPARSE;
+    cfs->pdata.sn = cfs->sn;
+    strscpy(cfs->sn, name, sizeof(cfs->sn));
+
+    config_item_init_type_name(&cfs->item, name, &pcd_cfs_dev_type);
+
+    return &cfs->item;
+}
+
+/* rmdir, also tears the device down if it is still enabled */
+static void pcd_cfs_drop_item(struct config_group *group, struct config_item *item)
+{
+    struct pcd_cfs_dev *cfs = to_pcd_cfs_dev(item);
+
+    mutex_lock(&cfs->lock);
+    if (cfs->dev_data) {
+        pcd_dev_destroy(cfs->dev_data);
+        cfs->dev_data = NULL;
+    }
+    mutex_unlock(&cfs->lock);
+
+    config_item_put(item);
+}
+
+static struct configfs_group_operations pcd_cfs_group_ops = {
+    .make_item = pcd_cfs_make_item,
+    .drop_item = pcd_cfs_drop_item,
+};
+
+static const struct config_item_type pcd_cfs_group_type = {
+    .ct_group_ops = &pcd_cfs_group_ops,
+    .ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem pcd_cfs_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "pcd",
+            .ci_type = &pcd_cfs_group_type,
+        },
+    },
+};
+
+/* Init and deinit */
+
+static int __init pcd_driver_init(void)
+{
+    int rc;
+    unsigned int i;
+
+    pr_info("PCD plat driver init\n");
+
+    /* 0. sysfs attributes shared with the other pcd drivers */
+    pcd_attr_group_init(&pcd_core_attrs, to_pcd);
+
+    /* 1. Dynamically allocate a device num */
+    rc = alloc_chrdev_region(&pcdrv_data.dev_num_base, 0, PCD_MAX_MINORS, "pcddevs");
+    if (rc < 0)
+        goto out;
+    ida_init(&pcdrv_data.minors);
+
+    /* 2. Create device class under /sys/class */
+    pcdrv_data.class_pcd = class_create("pcd_class");
+    if (IS_ERR(pcdrv_data.class_pcd)) {
+        pr_info("Class creation failed\n");
+        rc = PTR_ERR(pcdrv_data.class_pcd);
+        goto unreg_chrdev;
+    }
+
+    /* Removed along with the class directory */
+    for (i = 0; i < ARRAY_SIZE(pcd_class_attrs); i++) {
+        rc = class_create_file(pcdrv_data.class_pcd, pcd_class_attrs[i]);
+        if (rc)
+            goto destroy_class;
+    }
+
+    /* 3. Register a platform driver */
+    rc = platform_driver_register(&pcdev_plt_drv);
+    if (rc < 0)
+        goto destroy_class;
+
+    /* 4. Let devices be created through configfs */
+    config_group_init(&pcd_cfs_subsys.su_group);
+    mutex_init(&pcd_cfs_subsys.su_mutex);
+    rc = configfs_register_subsystem(&pcd_cfs_subsys);
+    if (rc < 0)
+        goto unreg_driver;
+
+    return 0;
+
+unreg_driver:
+    platform_driver_unregister(&pcdev_plt_drv);
+destroy_class:
+    class_destroy(pcdrv_data.class_pcd);
+unreg_chrdev:
+    unregister_chrdev_region(pcdrv_data.dev_num_base, PCD_MAX_MINORS);
+out:
+    pr_info("PCD module insertion failed\n");
+    return rc;
+}
+
+static void __exit pcd_driver_cleanup(void)
+{
+    pr_info("PCD plat driver exit\n");
+
+    /* 1. configfs directories pin the module, so none are left at this point */
+    configfs_unregister_subsystem(&pcd_cfs_subsys);
 
-    /* 1. Unregister plat driver */
+    /* 2. Unregister plat driver */
     platform_driver_unregister(&pcdev_plt_drv);
 
-    /* 2. Destroy device class */
+    /* 3. Destroy device class */
     class_destroy(pcdrv_data.class_pcd);
 
-    /* 3. Dealloc device num */
-    unregister_chrdev_region(pcdrv_data.dev_num_base, MAX_N_DEVICES);
+    /* 4. Dealloc device num */
+    ida_destroy(&pcdrv_data.minors);
+    unregister_chrdev_region(pcdrv_data.dev_num_base, PCD_MAX_MINORS);
 }
 
 module_init(pcd_driver_init);
 module_exit(pcd_driver_cleanup);
 
+MODULE_IMPORT_NS(DMA_BUF);
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Kieran");
 MODULE_DESCRIPTION("A pseudo char driver using internal memory");
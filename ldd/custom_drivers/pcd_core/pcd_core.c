@@ -0,0 +1,2313 @@
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/highmem.h>
+#include <linux/xarray.h>
+#include <linux/shrinker.h>
+#include <linux/prefetch.h>
+#include <linux/sched/signal.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/crc32c.h>
+#include <linux/wait.h>
+#include <linux/uio.h>
+#include <linux/uaccess.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/debugfs.h>
+#include <linux/srcu.h>
+#include <linux/kthread.h>
+#include <linux/delay.h>
+
+#include "pcd_heat.h"
+
+#include "pcd_core.h"
+
+/* Format pr_info() so it prints funtion name first */
+#undef pr_fmt
+#define pr_fmt(fmt) "%s : " fmt, __func__
+
+/* Large transfers are copied in chunks of this size with a preemption point between each.
+* Sparse memory is page backed, so a chunk never spans two pages. */
+#define PCD_COPY_CHUNK   (PAGE_SIZE)
+
+/* Sparse devices of at least this many pages give zero filled pages back under memory pressure */
+#define PCD_RECLAIM_MIN_PAGES   (16)
+
+/* Set on pages written since the reclaim scan last looked at them */
+#define PCD_PAGE_UNSCANNED      XA_MARK_0
+
+/* Set on pages written since the dedup scan last looked at them */
+#define PCD_PAGE_UNMERGED       XA_MARK_1
+
+/* Set on pages in the dedup table. They are read only, writers copy them first. */
+#define PCD_PAGE_SHARED         XA_MARK_2
+
+/* Counts of a device heatmap halve this often unless the driver says otherwise */
+#define PCD_HEAT_HALF_LIFE_MS   (10000)
+
+/* Dedup table size and the number of pages one scan pass looks at */
+#define PCD_DEDUP_HASH_BITS     (10)
+#define PCD_DEDUP_BATCH         (1024)
+
+/* Synthetic source defaults, and how often its thread wakes up to catch up */
+#define PCD_SRC_RATE            (1000)
+#define PCD_SRC_REC_SIZE        (64)
+#define PCD_SRC_TICK_US         (100)
+
+/* Granularity of the integrity checksums kept over each device buffer */
+#define PCD_CRC_BLK_SIZE (256)
+
+/* A page shared by content between sparse devices. users counts the device
+* slots pointing at it, each of which holds a page reference. */
+struct pcd_dedup_page {
+    struct hlist_node node;
+    struct page *page;
+    u32 hash;
+    unsigned int users;
+};
+
+static void pcd_dedup_scan(struct work_struct *work);
+
+/* Core data - statically alloc */
+struct pcdcore_priv_data {
+    struct mutex devices_lock;
+    struct list_head devices;
+    struct shrinker *shrinker;
+
+    /* Page dedup, dedup_lock nests inside pcd->lock */
+    struct mutex dedup_lock;
+    DECLARE_HASHTABLE(dedup_table, PCD_DEDUP_HASH_BITS);
+    struct pcd_dedup_stats dedup_stats;
+    struct delayed_work dedup_work;
+
+    struct dentry *debugfs;
+};
+
+static struct pcdcore_priv_data pcdcore_data = {
+    .devices_lock = __MUTEX_INITIALIZER(pcdcore_data.devices_lock),
+    .devices = LIST_HEAD_INIT(pcdcore_data.devices),
+    .dedup_lock = __MUTEX_INITIALIZER(pcdcore_data.dedup_lock),
+    .dedup_work = __DELAYED_WORK_INITIALIZER(pcdcore_data.dedup_work, pcd_dedup_scan, 0),
+};
+
+static unsigned int dedup_interval_ms;
+
+/* Kick the scan when switched on so it doesn't wait for a device to be written */
+static int pcd_dedup_interval_set(const char *val, const struct kernel_param *kp)
+{
+    int rc = param_set_uint(val, kp);
+
+    if (!rc && dedup_interval_ms)
+        mod_delayed_work(system_wq, &pcdcore_data.dedup_work, 0);
+
+    return rc;
+}
+
+static const struct kernel_param_ops pcd_dedup_interval_ops = {
+    .set = pcd_dedup_interval_set,
+    .get = param_get_uint,
+};
+
+module_param_cb(dedup_interval_ms, &pcd_dedup_interval_ops, &dedup_interval_ms, 0644);
+MODULE_PARM_DESC(dedup_interval_ms, "Period of the scan sharing identical pages between sparse devices, 0 to disable");
+
+/* Bytes that can be copied from pos before crossing a chunk boundary */
+static size_t pcd_chunk_len(loff_t pos, size_t count)
+{
+    return min_t(size_t, count, PCD_COPY_CHUNK - (pos & (PCD_COPY_CHUNK - 1)));
+}
+
+/* Bytes that can be copied backwards from end before crossing a chunk boundary */
+static size_t pcd_tail_len(loff_t end, size_t count)
+{
+    size_t in_chunk = end & (PCD_COPY_CHUNK - 1);
+
+    return min_t(size_t, count, in_chunk ? in_chunk : PCD_COPY_CHUNK);
+}
+
+/* Sparse pages are only allocated once written, an absent page reads as zeroes */
+static struct page *pcd_sparse_page(struct pcd_dev *pcd, loff_t pos)
+{
+    struct page *page = xa_load(&pcd->pages, pos >> PAGE_SHIFT);
+
+    return page ? page : ZERO_PAGE(0);
+}
+
+/* Drop a device slot's reference to a shared page, the last one takes it out of the table */
+static void pcd_dedup_put(struct page *page)
+{
+    struct pcd_dedup_page *dp;
+    struct pcd_dedup_stats *st = &pcdcore_data.dedup_stats;
+
+    mutex_lock(&pcdcore_data.dedup_lock);
+    dp = (struct pcd_dedup_page *)page_private(page);
+    if (dp->users == 2) {
+        st->shared--;
+        st->mapped -= 2;
+    } else if (dp->users > 2) {
+        st->mapped--;
+    }
+    if (!--dp->users) {
+        hash_del(&dp->node);
+        set_page_private(page, 0);
+        kfree(dp);
+    }
+    mutex_unlock(&pcdcore_data.dedup_lock);
+
+    put_page(page);
+}
+
+/* Give the slot at idx a private copy of its shared page. A page nothing was
+* merged into is only taken back out of the table, there is nobody to copy for. */
+static int pcd_dedup_cow(struct pcd_dev *pcd, unsigned long idx, struct page *shared)
+{
+    struct pcd_dedup_page *dp;
+    struct page *page;
+
+    mutex_lock(&pcdcore_data.dedup_lock);
+    dp = (struct pcd_dedup_page *)page_private(shared);
+    if (dp->users == 1) {
+        hash_del(&dp->node);
+        set_page_private(shared, 0);
+        mutex_unlock(&pcdcore_data.dedup_lock);
+        kfree(dp);
+
+        xa_clear_mark(&pcd->pages, idx, PCD_PAGE_SHARED);
+        pcd->shared--;
+        return 0;
+    }
+    mutex_unlock(&pcdcore_data.dedup_lock);
+
+    page = alloc_page(GFP_HIGHUSER);
+    if (!page)
+        return -ENOMEM;
+
+    copy_highpage(page, shared);
+
+    /* Replacing a present entry needs no allocation */
+    xa_store(&pcd->pages, idx, page, GFP_KERNEL);
+    xa_clear_mark(&pcd->pages, idx, PCD_PAGE_SHARED);
+    pcd->shared--;
+
+    pcd_dedup_put(shared);
+
+    mutex_lock(&pcdcore_data.dedup_lock);
+    pcdcore_data.dedup_stats.cow++;
+    mutex_unlock(&pcdcore_data.dedup_lock);
+
+    return 0;
+}
+
+/* Allocate the pages of a range about to be written, or copy them if shared,
+* and flag them for the reclaim and dedup scans */
+static int pcd_sparse_reserve(struct pcd_dev *pcd, loff_t pos, size_t count)
+{
+    unsigned long idx, last;
+    struct page *page;
+
+    if (!count)
+        return 0;
+
+    last = (pos + count - 1) >> PAGE_SHIFT;
+    for (idx = pos >> PAGE_SHIFT; idx <= last; ++idx) {
+        page = xa_load(&pcd->pages, idx);
+        if (page && xa_get_mark(&pcd->pages, idx, PCD_PAGE_SHARED)) {
+            if (pcd_dedup_cow(pcd, idx, page))
+                return -ENOMEM;
+        } else if (!page) {
+            page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+            if (!page)
+                return -ENOMEM;
+
+            if (xa_err(xa_store(&pcd->pages, idx, page, GFP_KERNEL))) {
+                __free_page(page);
+                return -ENOMEM;
+            }
+            pcd->resident++;
+        }
+
+        if (!xa_get_mark(&pcd->pages, idx, PCD_PAGE_UNSCANNED)) {
+            xa_set_mark(&pcd->pages, idx, PCD_PAGE_UNSCANNED);
+            pcd->unscanned++;
+        }
+
+        if (!xa_get_mark(&pcd->pages, idx, PCD_PAGE_UNMERGED))
+            xa_set_mark(&pcd->pages, idx, PCD_PAGE_UNMERGED);
+    }
+
+    return 0;
+}
+
+/* Kernel address of pos, valid up to the end of its chunk. With a constant backend
+* this folds down to the one storage access that backend needs. */
+static __always_inline char *pcd_map(struct pcd_dev *pcd, loff_t pos, const enum pcd_backend backend)
+{
+    if (backend == PCD_BACKEND_SPARSE)
+        return (char *)kmap_local_page(pcd_sparse_page(pcd, pos)) + offset_in_page(pos);
+
+    return pcd->mem + pos;
+}
+
+static __always_inline void pcd_unmap(char *vaddr, const enum pcd_backend backend)
+{
+    if (backend == PCD_BACKEND_SPARSE)
+        kunmap_local(vaddr);
+}
+
+/* Highmem pages have no permanent mapping to prefetch through */
+static __always_inline void pcd_prefetch(struct pcd_dev *pcd, loff_t pos, size_t len, const enum pcd_backend backend)
+{
+    struct page *page;
+
+    if (backend != PCD_BACKEND_SPARSE) {
+        prefetch_range(pcd->mem + pos, len);
+        return;
+    }
+
+    page = xa_load(&pcd->pages, pos >> PAGE_SHIFT);
+    if (page && !PageHighMem(page))
+        prefetch_range(page_address(page) + offset_in_page(pos), len);
+}
+
+/* Called between chunks. Gives other tasks the CPU and stops early on a signal,
+* the caller then returns the progress made so far. */
+static bool pcd_copy_should_stop(struct pcd_dev *pcd)
+{
+    mutex_unlock(&pcd->lock);
+    cond_resched();
+
+    if (signal_pending(current))
+        return true;
+
+    mutex_lock(&pcd->lock);
+    return false;
+}
+
+/* Data path of the positional backends. Never called with a variable backend,
+* PCD_DEFINE_RW() stamps out one copy per backend. */
+
+static __always_inline ssize_t pcd_do_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos,
+    const enum pcd_backend backend)
+{
+    int rc = 0;
+    size_t count = iov_iter_count(to), done = 0, chunk, copied;
+    loff_t pos = *f_pos;
+    char *vaddr;
+
+    if (pos >= pcd->size)
+        return 0;
+
+    if ((pos + count) > pcd->size)
+        count = pcd->size - pos;
+
+    mutex_lock(&pcd->lock);
+
+    while (done < count) {
+        chunk = pcd_chunk_len(pos, count - done);
+
+        if (unlikely(pcd->crc)) {
+            rc = pcd_crc_verify(pcd, pos, chunk);
+            if (rc)
+                break;
+        }
+
+        /* Pull the next chunk into the cache while this one is copied out */
+        if (done + chunk < count)
+            pcd_prefetch(pcd, pos + chunk, pcd_chunk_len(pos + chunk, count - done - chunk), backend);
+
+        vaddr = pcd_map(pcd, pos, backend);
+        copied = copy_to_iter(vaddr, chunk, to);
+        pcd_unmap(vaddr, backend);
+        done += copied;
+        pos += copied;
+        if (copied != chunk) {
+            rc = -EFAULT;
+            break;
+        }
+
+        if (done < count && pcd_copy_should_stop(pcd))
+            goto out;
+    }
+
+    mutex_unlock(&pcd->lock);
+
+out:
+    if (!done)
+        return rc;
+
+    *f_pos = pos;
+
+    return done;
+}
+
+static __always_inline ssize_t pcd_do_write(struct pcd_dev *pcd, struct iov_iter *from, loff_t *f_pos,
+    const enum pcd_backend backend)
+{
+    int rc = 0;
+    size_t count = iov_iter_count(from), done = 0, chunk, copied;
+    loff_t pos = *f_pos;
+    char *vaddr;
+
+    /* pwrite() can start past the end, where the clamp below would wrap */
+    if (pos >= pcd->size)
+        return -ENOMEM;
+
+    if ((pos + count) > pcd->size)
+        count = pcd->size - pos;
+
+    if (!count)
+        return -ENOMEM;
+
+    mutex_lock(&pcd->lock);
+
+    while (done < count) {
+        chunk = pcd_chunk_len(pos, count - done);
+
+        if (backend == PCD_BACKEND_SPARSE) {
+            rc = pcd_sparse_reserve(pcd, pos, chunk);
+            if (rc)
+                break;
+        }
+
+        vaddr = pcd_map(pcd, pos, backend);
+        copied = copy_from_iter(vaddr, chunk, from);
+        pcd_unmap(vaddr, backend);
+
+        /* A faulting copy may have partially landed, so re-hash regardless */
+        if (unlikely(pcd->crc))
+            pcd_crc_update(pcd, pos, chunk);
+
+        done += copied;
+        pos += copied;
+        if (copied != chunk) {
+            rc = -EFAULT;
+            break;
+        }
+
+        if (done < count && pcd_copy_should_stop(pcd))
+            goto out;
+    }
+
+    mutex_unlock(&pcd->lock);
+
+out:
+    if (!done)
+        return rc;
+
+    *f_pos = pos;
+
+    return done;
+}
+
+#define PCD_DEFINE_RW(_name, _backend)                                                          \
+static ssize_t pcd_##_name##_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos,     \
+    unsigned int f_flags)                                                                       \
+{                                                                                               \
+    return pcd_do_read(pcd, to, f_pos, _backend);                                               \
+}                                                                                               \
+                                                                                                \
+static ssize_t pcd_##_name##_write(struct pcd_dev *pcd, struct iov_iter *from, loff_t *f_pos,  \
+    unsigned int f_flags)                                                                       \
+{                                                                                               \
+    return pcd_do_write(pcd, from, f_pos, _backend);                                            \
+}
+
+/* Static and linear memory look the same to the data path, they share a copy */
+PCD_DEFINE_RW(linear, PCD_BACKEND_LINEAR)
+PCD_DEFINE_RW(sparse, PCD_BACKEND_SPARSE)
+
+/* Ring backend. Offsets are ignored, writes append and wait while the ring is
+* full, reads consume and wait while it is empty. */
+
+static int pcd_ring_wait(struct pcd_dev *pcd, bool write)
+{
+    if (write)
+        return wait_event_interruptible(pcd->ring_writers, READ_ONCE(pcd->ring_len) < pcd->size);
+
+    return wait_event_interruptible(pcd->ring_readers, READ_ONCE(pcd->ring_len));
+}
+
+static ssize_t pcd_ring_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos, unsigned int f_flags)
+{
+    int rc = 0;
+    size_t count = iov_iter_count(to), done = 0, chunk, copied;
+
+    if (!count)
+        return 0;
+
+    mutex_lock(&pcd->lock);
+
+    while (!pcd->ring_len) {
+        mutex_unlock(&pcd->lock);
+
+        if (f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        if (pcd_ring_wait(pcd, false))
+            return -ERESTARTSYS;
+
+        mutex_lock(&pcd->lock);
+    }
+
+    while (done < count && pcd->ring_len) {
+        chunk = min3(count - done, pcd->ring_len, pcd->size - pcd->ring_head);
+        chunk = min_t(size_t, chunk, PCD_COPY_CHUNK);
+
+        copied = copy_to_iter(pcd->mem + pcd->ring_head, chunk, to);
+        pcd->ring_head += copied;
+        if (pcd->ring_head == pcd->size)
+            pcd->ring_head = 0;
+        pcd->ring_len -= copied;
+        done += copied;
+        if (copied != chunk) {
+            rc = -EFAULT;
+            break;
+        }
+
+        if (done < count && pcd->ring_len && pcd_copy_should_stop(pcd))
+            goto out;
+    }
+
+    mutex_unlock(&pcd->lock);
+
+out:
+    if (!done)
+        return rc;
+
+    wake_up_interruptible(&pcd->ring_writers);
+
+    return done;
+}
+
+static ssize_t pcd_ring_write(struct pcd_dev *pcd, struct iov_iter *from, loff_t *f_pos, unsigned int f_flags)
+{
+    int rc = 0;
+    size_t count = iov_iter_count(from), done = 0, chunk, copied, tail;
+
+    if (!count)
+        return 0;
+
+    mutex_lock(&pcd->lock);
+
+    while (pcd->ring_len == pcd->size) {
+        mutex_unlock(&pcd->lock);
+
+        if (f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        if (pcd_ring_wait(pcd, true))
+            return -ERESTARTSYS;
+
+        mutex_lock(&pcd->lock);
+    }
+
+    while (done < count && pcd->ring_len < pcd->size) {
+        tail = pcd->ring_head + pcd->ring_len;
+        if (tail >= pcd->size)
+            tail -= pcd->size;
+
+        chunk = min3(count - done, pcd->size - pcd->ring_len, pcd->size - tail);
+        chunk = min_t(size_t, chunk, PCD_COPY_CHUNK);
+
+        copied = copy_from_iter(pcd->mem + tail, chunk, from);
+        pcd->ring_len += copied;
+        done += copied;
+        if (copied != chunk) {
+            rc = -EFAULT;
+            break;
+        }
+
+        if (done < count && pcd->ring_len < pcd->size && pcd_copy_should_stop(pcd))
+            goto out;
+    }
+
+    mutex_unlock(&pcd->lock);
+
+out:
+    if (!done)
+        return rc;
+
+    wake_up_interruptible(&pcd->ring_readers);
+
+    return done;
+}
+
+/* Backend setup and teardown */
+
+static int pcd_static_init(struct pcd_dev *pcd, void *mem)
+{
+    if (!mem)
+        return -EINVAL;
+
+    pcd->mem = mem;
+    return 0;
+}
+
+static void pcd_static_free(struct pcd_dev *pcd)
+{
+}
+
+static int pcd_linear_init(struct pcd_dev *pcd, void *mem)
+{
+    pcd->mem = kvzalloc(pcd->size, GFP_KERNEL);
+
+    return pcd->mem ? 0 : -ENOMEM;
+}
+
+static void pcd_linear_free(struct pcd_dev *pcd)
+{
+    kvfree(pcd->mem);
+}
+
+static void pcd_linear_clear(struct pcd_dev *pcd)
+{
+    memset(pcd->mem, 0, pcd->size);
+}
+
+/* Nothing is allocated up front, sparse devices start out empty */
+static int pcd_sparse_init(struct pcd_dev *pcd, void *mem)
+{
+    xa_init(&pcd->pages);
+    pcd->nr_pages = DIV_ROUND_UP(pcd->size, PAGE_SIZE);
+
+    /* Listed for the reclaim and dedup scans */
+    mutex_lock(&pcdcore_data.devices_lock);
+    list_add_tail(&pcd->node, &pcdcore_data.devices);
+    mutex_unlock(&pcdcore_data.devices_lock);
+
+    return 0;
+}
+
+static void pcd_sparse_free(struct pcd_dev *pcd)
+{
+    unsigned long i;
+    struct page *page;
+
+    mutex_lock(&pcdcore_data.devices_lock);
+    list_del(&pcd->node);
+    mutex_unlock(&pcdcore_data.devices_lock);
+
+    /* Pages still exported as dma-bufs stay alive on the dma-buf's reference */
+    xa_for_each(&pcd->pages, i, page) {
+        if (xa_get_mark(&pcd->pages, i, PCD_PAGE_SHARED))
+            pcd_dedup_put(page);
+        else
+            put_page(page);
+    }
+
+    xa_destroy(&pcd->pages);
+}
+
+static void pcd_sparse_clear(struct pcd_dev *pcd)
+{
+    unsigned long i;
+    struct page *page;
+
+    xa_for_each(&pcd->pages, i, page) {
+        bool shared = xa_get_mark(&pcd->pages, i, PCD_PAGE_SHARED);
+
+        /* Still shared with a dma-buf, keep the page so they stay connected */
+        if (!shared && page_count(page) > 1) {
+            clear_highpage(page);
+            continue;
+        }
+
+        if (xa_get_mark(&pcd->pages, i, PCD_PAGE_UNSCANNED))
+            pcd->unscanned--;
+        xa_erase(&pcd->pages, i);
+        if (shared) {
+            pcd->shared--;
+            pcd_dedup_put(page);
+        } else {
+            put_page(page);
+        }
+        pcd->resident--;
+    }
+}
+
+static int pcd_ring_init(struct pcd_dev *pcd, void *mem)
+{
+    init_waitqueue_head(&pcd->ring_readers);
+    init_waitqueue_head(&pcd->ring_writers);
+
+    return pcd_linear_init(pcd, mem);
+}
+
+static void pcd_ring_clear(struct pcd_dev *pcd)
+{
+    pcd->ring_head = 0;
+    pcd->ring_len = 0;
+    wake_up_interruptible(&pcd->ring_writers);
+}
+
+static const struct pcd_backend_ops pcd_backends[PCD_BACKEND_MAX] = {
+    [PCD_BACKEND_STATIC] = {
+        .name = "static",
+        .seekable = true,
+        .init = pcd_static_init,
+        .free = pcd_static_free,
+        .clear = pcd_linear_clear,
+        .read = pcd_linear_read,
+        .write = pcd_linear_write,
+    },
+    [PCD_BACKEND_LINEAR] = {
+        .name = "linear",
+        .seekable = true,
+        .init = pcd_linear_init,
+        .free = pcd_linear_free,
+        .clear = pcd_linear_clear,
+        .read = pcd_linear_read,
+        .write = pcd_linear_write,
+    },
+    [PCD_BACKEND_SPARSE] = {
+        .name = "sparse",
+        .seekable = true,
+        .init = pcd_sparse_init,
+        .free = pcd_sparse_free,
+        .clear = pcd_sparse_clear,
+        .read = pcd_sparse_read,
+        .write = pcd_sparse_write,
+    },
+    [PCD_BACKEND_RING] = {
+        .name = "ring",
+        .seekable = false,
+        .init = pcd_ring_init,
+        .free = pcd_linear_free,
+        .clear = pcd_ring_clear,
+        .read = pcd_ring_read,
+        .write = pcd_ring_write,
+    },
+};
+
+/* Byte range access. These take the backend at run time, they serve the slower
+* paths layered on top of the buffer such as record mode and checksums. */
+
+int pcd_mem_reserve(struct pcd_dev *pcd, loff_t pos, size_t count)
+{
+    if (pcd->backend != PCD_BACKEND_SPARSE)
+        return 0;
+
+    return pcd_sparse_reserve(pcd, pos, count);
+}
+EXPORT_SYMBOL_GPL(pcd_mem_reserve);
+
+void pcd_mem_read(struct pcd_dev *pcd, loff_t pos, void *dst, size_t count)
+{
+    size_t chunk;
+    char *vaddr;
+
+    while (count) {
+        chunk = pcd_chunk_len(pos, count);
+        vaddr = pcd_map(pcd, pos, pcd->backend);
+        memcpy(dst, vaddr, chunk);
+        pcd_unmap(vaddr, pcd->backend);
+        dst += chunk;
+        pos += chunk;
+        count -= chunk;
+    }
+}
+EXPORT_SYMBOL_GPL(pcd_mem_read);
+
+void pcd_mem_write(struct pcd_dev *pcd, loff_t pos, const void *src, size_t count)
+{
+    size_t chunk;
+    char *vaddr;
+
+    while (count) {
+        chunk = pcd_chunk_len(pos, count);
+        vaddr = pcd_map(pcd, pos, pcd->backend);
+        memcpy(vaddr, src, chunk);
+        pcd_unmap(vaddr, pcd->backend);
+        src += chunk;
+        pos += chunk;
+        count -= chunk;
+    }
+}
+EXPORT_SYMBOL_GPL(pcd_mem_write);
+
+/* Returns the number of bytes that could not be copied, like copy_to_user() */
+size_t pcd_mem_to_user(struct pcd_dev *pcd, loff_t pos, char __user *buf, size_t count)
+{
+    size_t chunk, copied;
+    struct iov_iter iter;
+    char *vaddr;
+
+    if (import_ubuf(ITER_DEST, buf, count, &iter))
+        return count;
+
+    while (count) {
+        chunk = pcd_chunk_len(pos, count);
+        vaddr = pcd_map(pcd, pos, pcd->backend);
+        copied = copy_to_iter(vaddr, chunk, &iter);
+        pcd_unmap(vaddr, pcd->backend);
+        count -= copied;
+        if (copied != chunk)
+            return count;
+        pos += chunk;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_mem_to_user);
+
+/* Returns the number of bytes that could not be copied, like copy_from_user() */
+size_t pcd_mem_from_user(struct pcd_dev *pcd, loff_t pos, const char __user *buf, size_t count)
+{
+    size_t chunk, copied;
+    struct iov_iter iter;
+    char *vaddr;
+
+    if (import_ubuf(ITER_SOURCE, (char __user *)buf, count, &iter))
+        return count;
+
+    while (count) {
+        chunk = pcd_chunk_len(pos, count);
+        vaddr = pcd_map(pcd, pos, pcd->backend);
+        copied = copy_from_iter(vaddr, chunk, &iter);
+        pcd_unmap(vaddr, pcd->backend);
+        count -= copied;
+        if (copied != chunk)
+            return count;
+        pos += chunk;
+    }
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_mem_from_user);
+
+/* memmove() between two devices, or within one. The range must not cross a chunk
+* on either side and the destination has to be reserved */
+static void pcd_mem_move(struct pcd_dev *dst, loff_t dst_pos, struct pcd_dev *src, loff_t src_pos, size_t count)
+{
+    char *dst_vaddr, *src_vaddr;
+    bool shared = src == dst && (src_pos >> PAGE_SHIFT) == (dst_pos >> PAGE_SHIFT);
+
+    /* One mapping when both sides share a page so memmove() sees the overlap */
+    dst_vaddr = pcd_map(dst, dst_pos, dst->backend);
+    if (shared)
+        src_vaddr = dst_vaddr - offset_in_page(dst_pos) + offset_in_page(src_pos);
+    else
+        src_vaddr = pcd_map(src, src_pos, src->backend);
+
+    memmove(dst_vaddr, src_vaddr, count);
+
+    if (!shared)
+        pcd_unmap(src_vaddr, src->backend);
+    pcd_unmap(dst_vaddr, dst->backend);
+}
+
+/* Page reclaim. Under memory pressure zero filled pages of sparse devices are
+* freed, reading them back gives the same zeroes. Only pages written since the
+* last scan are looked at, and pages with other users such as a dma-buf are left alone. */
+
+static unsigned long pcd_reclaimable(struct pcd_dev *pcd)
+{
+    unsigned long resident = READ_ONCE(pcd->resident);
+    unsigned long min_resident = READ_ONCE(pcd->min_resident);
+
+    /* Small devices aren't worth the scan */
+    if (pcd->nr_pages < PCD_RECLAIM_MIN_PAGES || resident <= min_resident)
+        return 0;
+
+    return min(READ_ONCE(pcd->unscanned), resident - min_resident);
+}
+
+/* Looks at up to budget pages, adding the number looked at to *scanned */
+static unsigned long pcd_reclaim(struct pcd_dev *pcd, unsigned long budget, unsigned long *scanned)
+{
+    bool zero;
+    char *vaddr;
+    struct page *page;
+    unsigned long idx = pcd->reclaim_cursor, freed = 0, done = 0;
+
+    while (done < budget && pcd->resident > pcd->min_resident) {
+        /* Resume where the last scan stopped, then wrap around. Scanning
+        clears the mark so no page is looked at twice. */
+        page = xa_find(&pcd->pages, &idx, ULONG_MAX, PCD_PAGE_UNSCANNED);
+        if (!page) {
+            idx = 0;
+            page = xa_find(&pcd->pages, &idx, ULONG_MAX, PCD_PAGE_UNSCANNED);
+            if (!page)
+                break;
+        }
+
+        done++;
+        xa_clear_mark(&pcd->pages, idx, PCD_PAGE_UNSCANNED);
+        pcd->unscanned--;
+
+        /* Shared pages are never zero filled, the dedup scan drops those instead */
+        if (page_count(page) == 1 && !xa_get_mark(&pcd->pages, idx, PCD_PAGE_SHARED)) {
+            vaddr = kmap_local_page(page);
+            zero = !memchr_inv(vaddr, 0, PAGE_SIZE);
+            kunmap_local(vaddr);
+
+            if (zero) {
+                xa_erase(&pcd->pages, idx);
+                put_page(page);
+                pcd->resident--;
+                pcd->reclaimed++;
+                freed++;
+            }
+        }
+
+        idx++;
+    }
+
+    pcd->reclaim_cursor = idx;
+    *scanned += done;
+
+    return freed;
+}
+
+static unsigned long pcd_shrink_count(struct shrinker *shrink, struct shrink_control *sc)
+{
+    unsigned long count = 0;
+    struct pcd_dev *pcd;
+
+    if (!mutex_trylock(&pcdcore_data.devices_lock))
+        return 0;
+
+    list_for_each_entry(pcd, &pcdcore_data.devices, node)
+        count += pcd_reclaimable(pcd);
+
+    mutex_unlock(&pcdcore_data.devices_lock);
+
+    return count ? count : SHRINK_EMPTY;
+}
+
+/* Reclaim must never wait on a device, busy ones are skipped until the next call.
+* sc->nr_scanned comes in already set to nr_to_scan, it is only written back. */
+static unsigned long pcd_shrink_scan(struct shrinker *shrink, struct shrink_control *sc)
+{
+    unsigned long freed = 0, scanned = 0;
+    struct pcd_dev *pcd;
+
+    if (!mutex_trylock(&pcdcore_data.devices_lock))
+        return SHRINK_STOP;
+
+    list_for_each_entry(pcd, &pcdcore_data.devices, node) {
+        if (scanned >= sc->nr_to_scan)
+            break;
+
+        if (!pcd_reclaimable(pcd) || !mutex_trylock(&pcd->lock))
+            continue;
+
+        freed += pcd_reclaim(pcd, sc->nr_to_scan - scanned, &scanned);
+        mutex_unlock(&pcd->lock);
+    }
+
+    /* Every device gets its turn at being scanned first */
+    if (!list_empty(&pcdcore_data.devices))
+        list_rotate_left(&pcdcore_data.devices);
+
+    mutex_unlock(&pcdcore_data.devices_lock);
+
+    sc->nr_scanned = scanned;
+
+    return freed;
+}
+
+/* Page dedup. A periodic scan walks the pages of every sparse device and points
+* slots holding the same data at one shared page, found through a hash of its
+* content. Zero filled pages are simply dropped. A page is only merged once a
+* pass went by without it being written, so pages under active use aren't
+* merged just to be copied again by the next write. */
+
+static bool pcd_dedup_same(struct page *a, struct page *b)
+{
+    bool same;
+    char *va = kmap_local_page(a);
+    char *vb = kmap_local_page(b);
+
+    same = !memcmp(va, vb, PAGE_SIZE);
+
+    kunmap_local(vb);
+    kunmap_local(va);
+
+    return same;
+}
+
+/* Called with pcd->lock held. Either merges the page at idx into a shared page
+* with the same data or makes it the shared page for that data. */
+static void pcd_dedup_merge(struct pcd_dev *pcd, unsigned long idx, struct page *page)
+{
+    u32 hash;
+    bool zero;
+    char *vaddr;
+    struct pcd_dedup_page *dp, *new;
+    struct pcd_dedup_stats *st = &pcdcore_data.dedup_stats;
+
+    vaddr = kmap_local_page(page);
+    zero = !memchr_inv(vaddr, 0, PAGE_SIZE);
+    hash = zero ? 0 : crc32c(0, vaddr, PAGE_SIZE);
+    kunmap_local(vaddr);
+
+    if (zero) {
+        if (xa_get_mark(&pcd->pages, idx, PCD_PAGE_UNSCANNED))
+            pcd->unscanned--;
+        xa_erase(&pcd->pages, idx);
+        put_page(page);
+        pcd->resident--;
+
+        mutex_lock(&pcdcore_data.dedup_lock);
+        st->zero++;
+        mutex_unlock(&pcdcore_data.dedup_lock);
+        return;
+    }
+
+    new = kzalloc(sizeof(*new), GFP_KERNEL);
+
+    mutex_lock(&pcdcore_data.dedup_lock);
+
+    hash_for_each_possible(pcdcore_data.dedup_table, dp, node, hash) {
+        if (dp->hash != hash || !pcd_dedup_same(dp->page, page))
+            continue;
+
+        if (++dp->users == 2) {
+            st->shared++;
+            st->mapped += 2;
+        } else {
+            st->mapped++;
+        }
+        get_page(dp->page);
+        mutex_unlock(&pcdcore_data.dedup_lock);
+
+        xa_store(&pcd->pages, idx, dp->page, GFP_KERNEL);
+        xa_set_mark(&pcd->pages, idx, PCD_PAGE_SHARED);
+        pcd->shared++;
+        put_page(page);
+        kfree(new);
+        return;
+    }
+
+    /* First page with this data, later ones are merged into it. It only counts
+    as shared once they are. */
+    if (new) {
+        new->page = page;
+        new->hash = hash;
+        new->users = 1;
+        set_page_private(page, (unsigned long)new);
+        hash_add(pcdcore_data.dedup_table, &new->node, hash);
+
+        xa_set_mark(&pcd->pages, idx, PCD_PAGE_SHARED);
+        pcd->shared++;
+    }
+
+    mutex_unlock(&pcdcore_data.dedup_lock);
+}
+
+/* Called with pcd->lock held. Resumes where the last pass stopped and wraps
+* around at most once, returns the number of pages looked at. */
+static unsigned long pcd_dedup_scan_dev(struct pcd_dev *pcd, unsigned long budget)
+{
+    bool wrapped = false;
+    struct page *page;
+    unsigned long idx = pcd->dedup_cursor, scanned = 0;
+
+    while (scanned < budget) {
+        page = xa_find(&pcd->pages, &idx, ULONG_MAX, XA_PRESENT);
+        if (!page) {
+            if (wrapped || !pcd->dedup_cursor)
+                break;
+            wrapped = true;
+            idx = 0;
+            continue;
+        }
+        if (wrapped && idx >= pcd->dedup_cursor)
+            break;
+
+        scanned++;
+
+        /* Written since the last pass, look again on the next one. Pages
+        with other users such as a dma-buf are left alone. */
+        if (xa_get_mark(&pcd->pages, idx, PCD_PAGE_UNMERGED))
+            xa_clear_mark(&pcd->pages, idx, PCD_PAGE_UNMERGED);
+        else if (!xa_get_mark(&pcd->pages, idx, PCD_PAGE_SHARED) && page_count(page) == 1)
+            pcd_dedup_merge(pcd, idx, page);
+
+        idx++;
+    }
+
+    pcd->dedup_cursor = idx;
+
+    return scanned;
+}
+
+static void pcd_dedup_scan(struct work_struct *work)
+{
+    unsigned int interval;
+    struct pcd_dev *pcd;
+    unsigned long budget = PCD_DEDUP_BATCH;
+
+    mutex_lock(&pcdcore_data.devices_lock);
+
+    list_for_each_entry(pcd, &pcdcore_data.devices, node) {
+        if (!budget)
+            break;
+
+        mutex_lock(&pcd->lock);
+        budget -= pcd_dedup_scan_dev(pcd, budget);
+        mutex_unlock(&pcd->lock);
+    }
+
+    /* Devices past the budget go first next time */
+    if (!list_empty(&pcdcore_data.devices))
+        list_rotate_left(&pcdcore_data.devices);
+
+    mutex_unlock(&pcdcore_data.devices_lock);
+
+    interval = READ_ONCE(dedup_interval_ms);
+    if (interval)
+        schedule_delayed_work(&pcdcore_data.dedup_work, msecs_to_jiffies(interval));
+}
+
+void pcd_dedup_stats(struct pcd_dedup_stats *st)
+{
+    mutex_lock(&pcdcore_data.dedup_lock);
+    *st = pcdcore_data.dedup_stats;
+    mutex_unlock(&pcdcore_data.dedup_lock);
+}
+EXPORT_SYMBOL_GPL(pcd_dedup_stats);
+
+/* Block checksums. All callers hold pcd->lock */
+
+static u32 pcd_crc_block(struct pcd_dev *pcd, unsigned blk)
+{
+    loff_t off = (loff_t)blk * PCD_CRC_BLK_SIZE;
+    char *vaddr;
+    u32 crc;
+
+    /* Blocks divide chunks evenly so a block is always within one mapping */
+    vaddr = pcd_map(pcd, off, pcd->backend);
+    crc = crc32c(~0, vaddr, min_t(size_t, PCD_CRC_BLK_SIZE, pcd->size - off));
+    pcd_unmap(vaddr, pcd->backend);
+
+    return crc;
+}
+
+/* Only the blocks touched by a write are re-hashed */
+void pcd_crc_update(struct pcd_dev *pcd, loff_t pos, size_t count)
+{
+    unsigned blk, last;
+
+    if (!pcd->crc || !count)
+        return;
+
+    last = (pos + count - 1) / PCD_CRC_BLK_SIZE;
+    for (blk = pos / PCD_CRC_BLK_SIZE; blk <= last; ++blk)
+        pcd->crc[blk] = pcd_crc_block(pcd, blk);
+}
+EXPORT_SYMBOL_GPL(pcd_crc_update);
+
+int pcd_crc_verify(struct pcd_dev *pcd, loff_t pos, size_t count)
+{
+    unsigned blk, last;
+    int rc = 0;
+
+    if (!pcd->crc || !count)
+        return 0;
+
+    last = (pos + count - 1) / PCD_CRC_BLK_SIZE;
+    for (blk = pos / PCD_CRC_BLK_SIZE; blk <= last; ++blk) {
+        pcd->crc_checked++;
+        if (pcd_crc_block(pcd, blk) != pcd->crc[blk]) {
+            pcd->crc_mismatches++;
+            pr_err("PCD Device %s checksum mismatch in block %u\n", pcd->sn, blk);
+            rc = -EIO;
+        }
+    }
+
+    return rc;
+}
+EXPORT_SYMBOL_GPL(pcd_crc_verify);
+
+/* Ring contents don't stay at a fixed offset, so rings are never checksummed */
+int pcd_crc_init(struct pcd_dev *pcd)
+{
+    BUILD_BUG_ON(PCD_COPY_CHUNK % PCD_CRC_BLK_SIZE);
+
+    if (!pcd->ops->seekable)
+        return 0;
+
+    pcd->crc = kcalloc(DIV_ROUND_UP(pcd->size, PCD_CRC_BLK_SIZE), sizeof(u32), GFP_KERNEL);
+    if (!pcd->crc)
+        return -ENOMEM;
+
+    pcd_crc_update(pcd, 0, pcd->size);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_crc_init);
+
+/* Access heatmap. On average 1 in heat_sample reads and writes on a CPU is counted
+* against each PCD_HEAT_REGION_SIZE region it touched, so the data path only pays
+* a per-CPU decrement for the others. The gap to the next sample is random, a
+* fixed one would alias with regular access patterns. Counts halve every
+* heat_half_life_ms, applied lazily whenever the map is touched. */
+
+static DEFINE_PER_CPU(int, pcd_heat_countdown);
+
+static size_t pcd_heat_regions(struct pcd_dev *pcd)
+{
+    return DIV_ROUND_UP(pcd->size, PCD_HEAT_REGION_SIZE);
+}
+
+/* Called with heat_lock held */
+static void pcd_heat_decay(struct pcd_dev *pcd, u64 now)
+{
+    u64 period, halvings;
+    size_t i, nr = pcd_heat_regions(pcd);
+    u32 half_life = READ_ONCE(pcd->heat_half_life_ms);
+
+    if (!half_life) {
+        pcd->heat_decay_ns = now;
+        return;
+    }
+
+    period = (u64)half_life * NSEC_PER_MSEC;
+    halvings = div64_u64(now - pcd->heat_decay_ns, period);
+    if (!halvings)
+        return;
+
+    pcd->heat_decay_ns += halvings * period;
+
+    if (halvings >= 32) {
+        memset(pcd->heat, 0, nr * sizeof(*pcd->heat));
+        return;
+    }
+
+    for (i = 0; i < nr; i++) {
+        pcd->heat[i].reads >>= halvings;
+        pcd->heat[i].writes >>= halvings;
+    }
+}
+
+void pcd_heat_record(struct pcd_dev *pcd, loff_t pos, size_t count, bool write)
+{
+    u32 *cnt;
+    size_t i, last;
+    u32 sample = READ_ONCE(pcd->heat_sample);
+
+    if (!sample || this_cpu_dec_return(pcd_heat_countdown) > 0)
+        return;
+
+    this_cpu_write(pcd_heat_countdown, get_random_u32_below(min(sample, U32_MAX / 2) * 2 - 1) + 1);
+
+    if (pos < 0 || pos >= pcd->size || !count)
+        return;
+
+    last = (min_t(u64, pos + count, pcd->size) - 1) / PCD_HEAT_REGION_SIZE;
+
+    spin_lock(&pcd->heat_lock);
+
+    if (pcd->heat) {
+        pcd_heat_decay(pcd, ktime_get_ns());
+
+        for (i = pos / PCD_HEAT_REGION_SIZE; i <= last; i++) {
+            cnt = write ? &pcd->heat[i].writes : &pcd->heat[i].reads;
+            if (*cnt != U32_MAX)
+                (*cnt)++;
+        }
+    }
+
+    spin_unlock(&pcd->heat_lock);
+}
+EXPORT_SYMBOL_GPL(pcd_heat_record);
+
+/* The map is allocated the first time sampling is turned on and kept until
+* pcd_core_free(), turning it off only stops the counting */
+int pcd_heat_set_sample(struct pcd_dev *pcd, u32 sample)
+{
+    struct pcd_heat_region *heat;
+
+    /* Ring contents don't stay at a fixed offset */
+    if (!pcd->ops->seekable)
+        return -EOPNOTSUPP;
+
+    if (sample && !READ_ONCE(pcd->heat)) {
+        heat = kvcalloc(pcd_heat_regions(pcd), sizeof(*heat), GFP_KERNEL);
+        if (!heat)
+            return -ENOMEM;
+
+        spin_lock(&pcd->heat_lock);
+        if (!pcd->heat) {
+            pcd->heat = heat;
+            pcd->heat_decay_ns = ktime_get_ns();
+            heat = NULL;
+        }
+        spin_unlock(&pcd->heat_lock);
+
+        kvfree(heat);
+    }
+
+    WRITE_ONCE(pcd->heat_sample, sample);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_heat_set_sample);
+
+/* The file serves a snapshot taken at open, so a reader sees one consistent map
+* however many reads it takes */
+static int pcd_heat_open(struct inode *inode, struct file *fh)
+{
+    struct pcd_dev *pcd = inode->i_private;
+    size_t nr = pcd_heat_regions(pcd);
+    struct pcd_heat_hdr *hdr;
+
+    hdr = kvzalloc(sizeof(*hdr) + nr * sizeof(struct pcd_heat_region), GFP_KERNEL);
+    if (!hdr)
+        return -ENOMEM;
+
+    hdr->magic = PCD_HEAT_MAGIC;
+    hdr->version = PCD_HEAT_VERSION;
+    hdr->region_size = PCD_HEAT_REGION_SIZE;
+    hdr->dev_size = pcd->size;
+    hdr->nr_regions = nr;
+
+    spin_lock(&pcd->heat_lock);
+    hdr->sample = READ_ONCE(pcd->heat_sample);
+    hdr->half_life_ms = READ_ONCE(pcd->heat_half_life_ms);
+    if (pcd->heat) {
+        pcd_heat_decay(pcd, ktime_get_ns());
+        memcpy(hdr + 1, pcd->heat, nr * sizeof(*pcd->heat));
+    }
+    spin_unlock(&pcd->heat_lock);
+
+    fh->private_data = hdr;
+
+    return 0;
+}
+
+static ssize_t pcd_heat_read(struct file *fh, char __user *buf, size_t count, loff_t *f_pos)
+{
+    struct pcd_heat_hdr *hdr = fh->private_data;
+
+    return simple_read_from_buffer(buf, count, f_pos, hdr,
+        sizeof(*hdr) + hdr->nr_regions * sizeof(struct pcd_heat_region));
+}
+
+static int pcd_heat_release(struct inode *inode, struct file *fh)
+{
+    kvfree(fh->private_data);
+
+    return 0;
+}
+
+static const struct file_operations pcd_heat_fops = {
+    .owner = THIS_MODULE,
+    .open = pcd_heat_open,
+    .read = pcd_heat_read,
+    .llseek = default_llseek,
+    .release = pcd_heat_release,
+};
+
+/* debugfs errors are not fatal, the device works without its files */
+void pcd_core_debugfs_add(struct pcd_dev *pcd, const char *name)
+{
+    pcd->debugfs = debugfs_create_dir(name, pcdcore_data.debugfs);
+    debugfs_create_file("heatmap", 0400, pcd->debugfs, pcd, &pcd_heat_fops);
+}
+EXPORT_SYMBOL_GPL(pcd_core_debugfs_add);
+
+/* Waits for readers already in the files. Safe to call more than once. */
+void pcd_core_debugfs_remove(struct pcd_dev *pcd)
+{
+    debugfs_remove_recursive(pcd->debugfs);
+    pcd->debugfs = NULL;
+}
+EXPORT_SYMBOL_GPL(pcd_core_debugfs_remove);
+
+/* Double buffering. Readers copy out of db_live inside an SRCU read section
+* and never take pcd->lock, writers keep going through the backend into mem,
+* now a shadow of the same size. A third buffer, db_spare, has no readers.
+* A commit copies the shadow into the spare under pcd->lock, points db_live
+* at the shadow and hands the spare to writers as the new shadow. Only then,
+* without pcd->lock, it waits for readers still on the old version, which
+* becomes the next spare. Readers see whole versions, writers never wait for
+* them and they never wait for writers. db_lock serialises commits and
+* switching the mode, it is taken before pcd->lock. */
+
+DEFINE_STATIC_SRCU(pcd_db_srcu);
+
+static void pcd_db_sync_copy(char *dst, const char *src, size_t size)
+{
+    size_t done, chunk;
+
+    for (done = 0; done < size; done += chunk) {
+        chunk = min_t(size_t, size - done, PCD_COPY_CHUNK);
+        memcpy(dst + done, src + done, chunk);
+        cond_resched();
+    }
+}
+
+ssize_t pcd_db_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos, unsigned int f_flags)
+{
+    int idx, rc = 0;
+    size_t count = iov_iter_count(to), done = 0, chunk, copied;
+    loff_t pos = *f_pos;
+    char *live;
+
+    idx = srcu_read_lock(&pcd_db_srcu);
+
+    /* Switched off since the caller looked */
+    live = srcu_dereference(pcd->db_live, &pcd_db_srcu);
+    if (!live) {
+        srcu_read_unlock(&pcd_db_srcu, idx);
+        return pcd->ops->read(pcd, to, f_pos, f_flags);
+    }
+
+    if (pos >= pcd->size)
+        count = 0;
+    else if ((pos + count) > pcd->size)
+        count = pcd->size - pos;
+
+    while (done < count) {
+        chunk = pcd_chunk_len(pos, count - done);
+        copied = copy_to_iter(live + pos, chunk, to);
+        done += copied;
+        pos += copied;
+        if (copied != chunk) {
+            rc = -EFAULT;
+            break;
+        }
+
+        /* A commit waits for this reader, keep the version pinned but let others run */
+        if (done < count) {
+            cond_resched();
+            if (signal_pending(current))
+                break;
+        }
+    }
+
+    srcu_read_unlock(&pcd_db_srcu, idx);
+
+    if (!done)
+        return rc;
+
+    *f_pos = pos;
+
+    return done;
+}
+EXPORT_SYMBOL_GPL(pcd_db_read);
+
+/* Publishes the writes made since the last commit */
+int pcd_db_commit(struct pcd_dev *pcd)
+{
+    char *old, *spare;
+
+    mutex_lock(&pcd->db_lock);
+    mutex_lock(&pcd->lock);
+
+    if (!pcd->db_buf) {
+        mutex_unlock(&pcd->lock);
+        mutex_unlock(&pcd->db_lock);
+        return -EINVAL;
+    }
+
+    spare = pcd->db_spare;
+    pcd_db_sync_copy(spare, pcd->mem, pcd->size);
+
+    old = rcu_dereference_protected(pcd->db_live, lockdep_is_held(&pcd->lock));
+    rcu_assign_pointer(pcd->db_live, pcd->mem);
+    pcd->mem = spare;
+    pcd->db_commits++;
+
+    mutex_unlock(&pcd->lock);
+
+    /* A reader on old may be stuck faulting in its user buffer, only the next
+    commit or switch off waits with it, the device stays usable meanwhile */
+    synchronize_srcu(&pcd_db_srcu);
+    pcd->db_spare = old;
+
+    mutex_unlock(&pcd->db_lock);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_db_commit);
+
+/* Turning it off publishes whatever was written since the last commit */
+int pcd_db_set(struct pcd_dev *pcd, bool on)
+{
+    char *buf = NULL, *old = NULL;
+
+    if (pcd->backend != PCD_BACKEND_STATIC && pcd->backend != PCD_BACKEND_LINEAR)
+        return on ? -EOPNOTSUPP : 0;
+
+    if (on) {
+        buf = kvmalloc_array(2, pcd->size, GFP_KERNEL);
+        if (!buf)
+            return -ENOMEM;
+    }
+
+    mutex_lock(&pcd->db_lock);
+    mutex_lock(&pcd->lock);
+
+    if (on) {
+        /* Readers do not verify checksums, the two do not mix */
+        if (pcd->db_buf || pcd->crc || pcd->db_blocked) {
+            mutex_unlock(&pcd->lock);
+            mutex_unlock(&pcd->db_lock);
+            kvfree(buf);
+            return pcd->db_buf ? 0 : -EBUSY;
+        }
+
+        /* One allocation holds the shadow and the spare */
+        pcd_db_sync_copy(buf, pcd->mem, pcd->size);
+        pcd->db_buf = buf;
+        pcd->db_spare = buf + pcd->size;
+        pcd->db_mem = pcd->mem;
+        rcu_assign_pointer(pcd->db_live, pcd->mem);
+        pcd->mem = buf;
+    } else if (pcd->db_buf) {
+        /* Readers now go through the backend and pcd->lock, which reads mem */
+        RCU_INIT_POINTER(pcd->db_live, NULL);
+        old = pcd->db_buf;
+    }
+
+    mutex_unlock(&pcd->lock);
+
+    if (old) {
+        synchronize_srcu(&pcd_db_srcu);
+
+        /* The backend gets its own buffer back */
+        mutex_lock(&pcd->lock);
+        if (pcd->mem != pcd->db_mem) {
+            pcd_db_sync_copy(pcd->db_mem, pcd->mem, pcd->size);
+            pcd->mem = pcd->db_mem;
+        }
+        pcd->db_buf = NULL;
+        pcd->db_spare = NULL;
+        pcd->db_mem = NULL;
+        mutex_unlock(&pcd->lock);
+    }
+
+    mutex_unlock(&pcd->db_lock);
+
+    kvfree(old);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_db_set);
+
+/* Synthetic source. A kthread appends records to a ring at src_rate per second
+* to load test readers without anything real behind the device. An hrtimer
+* callback can't take pcd->lock, so the thread sleeps PCD_SRC_TICK_US on one and
+* then writes every record that came due meanwhile in one go. A record that
+* doesn't fit is dropped and counted as an overrun, with the counter payload
+* readers see the gap in the sequence numbers. */
+
+struct pcd_src {
+    struct task_struct *task;
+    struct pcd_dev *pcd;
+    u32 rec_size;
+    u32 payload;
+    u8 rec[];
+};
+
+static const char *const pcd_src_payloads[PCD_SRC_PAYLOAD_MAX] = {
+    [PCD_SRC_COUNTER] = "counter",
+    [PCD_SRC_PATTERN] = "pattern",
+};
+
+int pcd_src_payload_parse(const char *buf)
+{
+    int i;
+
+    for (i = 0; i < PCD_SRC_PAYLOAD_MAX; i++)
+        if (sysfs_streq(buf, pcd_src_payloads[i]))
+            return i;
+
+    return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(pcd_src_payload_parse);
+
+const char *pcd_src_payload_name(u32 payload)
+{
+    return payload < PCD_SRC_PAYLOAD_MAX ? pcd_src_payloads[payload] : "unknown";
+}
+EXPORT_SYMBOL_GPL(pcd_src_payload_name);
+
+/* Appends up to n records, called with pcd->lock held. Returns how many fit. */
+static u64 pcd_src_fill(struct pcd_src *src, u64 n)
+{
+    struct pcd_dev *pcd = src->pcd;
+    size_t tail, first;
+    __le64 seq;
+    u64 i;
+
+    n = min_t(u64, n, (pcd->size - pcd->ring_len) / src->rec_size);
+
+    for (i = 0; i < n; i++) {
+        if (src->payload == PCD_SRC_COUNTER) {
+            seq = cpu_to_le64(pcd->src_records + i);
+            memcpy(src->rec, &seq, min_t(size_t, sizeof(seq), src->rec_size));
+        }
+
+        tail = pcd->ring_head + pcd->ring_len;
+        if (tail >= pcd->size)
+            tail -= pcd->size;
+
+        /* Records wrap around the end of the ring like any other write */
+        first = min_t(size_t, src->rec_size, pcd->size - tail);
+        memcpy(pcd->mem + tail, src->rec, first);
+        memcpy(pcd->mem, src->rec + first, src->rec_size - first);
+        pcd->ring_len += src->rec_size;
+    }
+
+    return n;
+}
+
+static void pcd_src_produce(struct pcd_src *src, u64 n)
+{
+    struct pcd_dev *pcd = src->pcd;
+    u64 per_lock = max_t(u64, PCD_COPY_CHUNK / src->rec_size, 1), batch, fit;
+
+    /* A chunk worth of records per lock hold, like the data path copies */
+    while (n) {
+        batch = min(n, per_lock);
+
+        mutex_lock(&pcd->lock);
+        fit = pcd_src_fill(src, batch);
+
+        /* Full, it stays that way for the rest of this tick */
+        if (fit < batch)
+            batch = n;
+        pcd->src_records += batch;
+        pcd->src_overruns += batch - fit;
+        mutex_unlock(&pcd->lock);
+
+        if (fit)
+            wake_up_interruptible(&pcd->ring_readers);
+
+        n -= batch;
+        cond_resched();
+    }
+}
+
+static int pcd_src_thread(void *data)
+{
+    struct pcd_src *src = data;
+    u64 start = 0, made = 0, due;
+    u32 rate = 0, cur;
+
+    while (!kthread_should_stop()) {
+        /* A new rate counts from now */
+        cur = READ_ONCE(src->pcd->src_rate);
+        if (cur != rate || !start) {
+            rate = cur;
+            start = ktime_get_ns();
+            made = 0;
+        }
+
+        due = mul_u64_u32_div(ktime_get_ns() - start, rate, NSEC_PER_SEC);
+        if (due > made) {
+            pcd_src_produce(src, due - made);
+            made = due;
+        }
+
+        usleep_range(PCD_SRC_TICK_US, PCD_SRC_TICK_US + PCD_SRC_TICK_US / 2);
+    }
+
+    return 0;
+}
+
+int pcd_src_start(struct pcd_dev *pcd)
+{
+    int rc;
+    u32 i, rec_size = READ_ONCE(pcd->src_rec_size);
+    struct pcd_src *src;
+
+    if (pcd->backend != PCD_BACKEND_RING)
+        return -EOPNOTSUPP;
+
+    if (!rec_size || rec_size > pcd->size)
+        return -EINVAL;
+
+    src = kvzalloc(struct_size(src, rec, rec_size), GFP_KERNEL);
+    if (!src)
+        return -ENOMEM;
+
+    src->pcd = pcd;
+    src->rec_size = rec_size;
+    src->payload = READ_ONCE(pcd->src_payload);
+    for (i = 0; i < rec_size; i++)
+        src->rec[i] = i;
+
+    src->task = kthread_create(pcd_src_thread, src, "pcd_src/%s", pcd->sn);
+    if (IS_ERR(src->task)) {
+        rc = PTR_ERR(src->task);
+        kvfree(src);
+        return rc;
+    }
+
+    mutex_lock(&pcd->lock);
+
+    if (pcd->src) {
+        mutex_unlock(&pcd->lock);
+        kthread_stop(src->task);
+        kvfree(src);
+        return -EBUSY;
+    }
+    pcd->src = src;
+
+    mutex_unlock(&pcd->lock);
+
+    wake_up_process(src->task);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_src_start);
+
+void pcd_src_stop(struct pcd_dev *pcd)
+{
+    struct pcd_src *src;
+
+    mutex_lock(&pcd->lock);
+    src = pcd->src;
+    pcd->src = NULL;
+    mutex_unlock(&pcd->lock);
+
+    if (!src)
+        return;
+
+    kthread_stop(src->task);
+    kvfree(src);
+}
+EXPORT_SYMBOL_GPL(pcd_src_stop);
+
+/* Scheduling between open files. Each client drains a token bucket refilled at
+* rate_limit bytes per second, and with fq_quantum set the device is handed out
+* in turns of at most that many bytes, in the order clients asked for it. A
+* client moving large buffers then waits its turn between quanta instead of
+* holding everyone else off for the whole transfer. */
+
+struct pcd_fq_waiter {
+    struct list_head node;
+    struct task_struct *task;
+};
+
+static u32 pcd_rate_burst(struct pcd_dev *pcd, u32 rate)
+{
+    return READ_ONCE(pcd->rate_burst) ? : rate;
+}
+
+/* Called with cl->lock held. A full refill is checked first so the multiply can't
+* overflow, and the clock only moves on once a whole token was earned. */
+static void pcd_rate_refill(struct pcd_client *cl, u32 rate, u32 burst)
+{
+    u64 now = ktime_get_ns();
+    u64 elapsed = now - cl->last_ns;
+    u64 earned;
+
+    if (cl->tokens >= burst || elapsed >= div_u64((burst - cl->tokens) * NSEC_PER_SEC, rate)) {
+        cl->tokens = burst;
+        cl->last_ns = now;
+        return;
+    }
+
+    earned = div_u64(elapsed * rate, NSEC_PER_SEC);
+    if (earned) {
+        cl->tokens += earned;
+        cl->last_ns = now;
+    }
+}
+
+/* Wait until the bucket holds count bytes and take them. The burst may have
+* shrunk since count was picked, a full bucket is enough then. */
+static int pcd_rate_take(struct pcd_dev *pcd, struct pcd_client *cl, u32 rate, size_t count, unsigned int f_flags)
+{
+    u32 burst;
+    u64 need, wait_ns;
+    ktime_t timeout;
+    bool throttled = false;
+
+    for (;;) {
+        spin_lock(&cl->lock);
+        burst = pcd_rate_burst(pcd, rate);
+        need = min_t(u64, count, burst);
+        pcd_rate_refill(cl, rate, burst);
+        if (cl->tokens >= need) {
+            cl->tokens -= need;
+            spin_unlock(&cl->lock);
+            break;
+        }
+        wait_ns = div_u64((need - cl->tokens) * NSEC_PER_SEC, rate);
+        spin_unlock(&cl->lock);
+
+        if (f_flags & O_NONBLOCK)
+            return -EAGAIN;
+
+        if (!throttled) {
+            atomic_long_inc(&pcd->rate_throttled);
+            throttled = true;
+        }
+
+        timeout = ns_to_ktime(wait_ns);
+        set_current_state(TASK_INTERRUPTIBLE);
+        schedule_hrtimeout(&timeout, HRTIMER_MODE_REL);
+        if (signal_pending(current))
+            return -ERESTARTSYS;
+    }
+
+    return 0;
+}
+
+/* Give back what a short read or write didn't use */
+static void pcd_rate_refund(struct pcd_dev *pcd, struct pcd_client *cl, u32 rate, size_t count)
+{
+    u32 burst = pcd_rate_burst(pcd, rate);
+
+    spin_lock(&cl->lock);
+    cl->tokens = min_t(u64, cl->tokens + count, burst);
+    spin_unlock(&cl->lock);
+}
+
+/* Queue up behind the clients already waiting and sleep until first in line */
+static int pcd_fq_enter(struct pcd_dev *pcd, struct pcd_fq_waiter *w)
+{
+    int rc = 0;
+
+    spin_lock(&pcd->fq_lock);
+    list_add_tail(&w->node, &pcd->fq_queue);
+
+    if (!list_is_first(&w->node, &pcd->fq_queue))
+        atomic_long_inc(&pcd->fq_waits);
+
+    for (;;) {
+        set_current_state(TASK_INTERRUPTIBLE);
+        if (list_is_first(&w->node, &pcd->fq_queue))
+            break;
+        if (signal_pending(current)) {
+            list_del(&w->node);
+            rc = -ERESTARTSYS;
+            break;
+        }
+        spin_unlock(&pcd->fq_lock);
+        schedule();
+        spin_lock(&pcd->fq_lock);
+    }
+
+    __set_current_state(TASK_RUNNING);
+    spin_unlock(&pcd->fq_lock);
+
+    return rc;
+}
+
+static void pcd_fq_exit(struct pcd_dev *pcd, struct pcd_fq_waiter *w)
+{
+    struct pcd_fq_waiter *next;
+
+    spin_lock(&pcd->fq_lock);
+    list_del(&w->node);
+    next = list_first_entry_or_null(&pcd->fq_queue, struct pcd_fq_waiter, node);
+    if (next)
+        wake_up_process(next->task);
+    spin_unlock(&pcd->fq_lock);
+}
+
+/* Splits the transfer into quanta and moves them one turn at a time. A turn is
+* never held while sleeping, so rings are accessed non-blocking within a turn
+* and waited on outside of it. Stops at the first short transfer like the
+* backends do, the caller gets the progress made so far. */
+ssize_t pcd_sched_rw(struct pcd_dev *pcd, struct pcd_client *cl, struct iov_iter *iter, loff_t *f_pos,
+    unsigned int f_flags, bool write)
+{
+    int rc;
+    ssize_t ret = 0;
+    size_t count = iov_iter_count(iter), done = 0, piece, rest;
+    u32 rate = READ_ONCE(pcd->rate_limit);
+    u32 quantum = READ_ONCE(pcd->fq_quantum);
+    unsigned int op_flags = quantum ? f_flags | O_NONBLOCK : f_flags;
+    struct pcd_fq_waiter w = { .task = current };
+
+    /* Nothing to schedule, the backend decides what an empty transfer returns */
+    if (!count)
+        return write ? pcd->ops->write(pcd, iter, f_pos, f_flags) : pcd_backend_read(pcd, iter, f_pos, f_flags);
+
+    while (done < count) {
+        piece = count - done;
+        if (quantum)
+            piece = min_t(size_t, piece, quantum);
+        if (rate)
+            piece = min_t(size_t, piece, pcd_rate_burst(pcd, rate));
+
+        if (rate) {
+            rc = pcd_rate_take(pcd, cl, rate, piece, f_flags);
+            if (rc) {
+                ret = rc;
+                break;
+            }
+        }
+
+        if (quantum) {
+            rc = pcd_fq_enter(pcd, &w);
+            if (rc) {
+                if (rate)
+                    pcd_rate_refund(pcd, cl, rate, piece);
+                ret = rc;
+                break;
+            }
+        }
+
+        rest = iov_iter_count(iter) - piece;
+        iov_iter_truncate(iter, piece);
+        if (write)
+            ret = pcd->ops->write(pcd, iter, f_pos, op_flags);
+        else
+            ret = pcd_backend_read(pcd, iter, f_pos, op_flags);
+        iov_iter_reexpand(iter, iov_iter_count(iter) + rest);
+
+        if (quantum)
+            pcd_fq_exit(pcd, &w);
+
+        if (rate && ret < (ssize_t)piece)
+            pcd_rate_refund(pcd, cl, rate, piece - max_t(ssize_t, ret, 0));
+
+        /* An empty or full ring, wait for it with the turn given up */
+        if (ret == -EAGAIN && quantum && !(f_flags & O_NONBLOCK) && !done) {
+            rc = pcd_ring_wait(pcd, write);
+            if (rc) {
+                ret = -ERESTARTSYS;
+                break;
+            }
+            continue;
+        }
+
+        if (ret <= 0)
+            break;
+
+        done += ret;
+        if ((size_t)ret < piece || signal_pending(current))
+            break;
+    }
+
+    return done ? done : ret;
+}
+EXPORT_SYMBOL_GPL(pcd_sched_rw);
+
+/* Device setup */
+
+int pcd_backend_parse(const char *buf)
+{
+    int i;
+
+    for (i = 0; i < PCD_BACKEND_MAX; i++)
+        if (sysfs_streq(buf, pcd_backends[i].name))
+            return i;
+
+    return -EINVAL;
+}
+EXPORT_SYMBOL_GPL(pcd_backend_parse);
+
+const char *pcd_backend_name(enum pcd_backend backend)
+{
+    return backend < PCD_BACKEND_MAX ? pcd_backends[backend].name : "unknown";
+}
+EXPORT_SYMBOL_GPL(pcd_backend_name);
+
+/* mem is the buffer of a static backend and ignored by the others */
+int pcd_core_init(struct pcd_dev *pcd, enum pcd_backend backend, void *mem)
+{
+    if (backend >= PCD_BACKEND_MAX || !pcd->size)
+        return -EINVAL;
+
+    pcd->backend = backend;
+    pcd->ops = &pcd_backends[backend];
+    mutex_init(&pcd->lock);
+    mutex_init(&pcd->db_lock);
+    spin_lock_init(&pcd->fq_lock);
+    INIT_LIST_HEAD(&pcd->fq_queue);
+    spin_lock_init(&pcd->heat_lock);
+    pcd->heat_half_life_ms = PCD_HEAT_HALF_LIFE_MS;
+    pcd->src_rate = PCD_SRC_RATE;
+    pcd->src_rec_size = PCD_SRC_REC_SIZE;
+
+    return pcd->ops->init(pcd, mem);
+}
+EXPORT_SYMBOL_GPL(pcd_core_init);
+
+void pcd_core_free(struct pcd_dev *pcd)
+{
+    pcd_core_debugfs_remove(pcd);
+    pcd_src_stop(pcd);
+    pcd_db_set(pcd, false);
+    pcd->ops->free(pcd);
+    kfree(pcd->crc);
+    pcd->crc = NULL;
+    kvfree(pcd->heat);
+    pcd->heat = NULL;
+}
+EXPORT_SYMBOL_GPL(pcd_core_free);
+
+/* Zero the buffer, called with pcd->lock held */
+void pcd_core_clear(struct pcd_dev *pcd)
+{
+    pcd->ops->clear(pcd);
+    pcd_crc_update(pcd, 0, pcd->size);
+}
+EXPORT_SYMBOL_GPL(pcd_core_clear);
+
+/* sysfs attributes */
+
+static const struct {
+    const char *name;
+    umode_t mode;
+} pcd_attr_info[PCD_ATTR_MAX] = {
+    [PCD_ATTR_CRC_CHECKED] = { "crc_checked", 0444 },
+    [PCD_ATTR_CRC_MISMATCHES] = { "crc_mismatches", 0444 },
+    /* Bytes per second each open file may move, 0 for no limit */
+    [PCD_ATTR_RATE_LIMIT] = { "rate_limit", 0644 },
+    /* Bytes an idle open file may move at once, 0 for one second worth */
+    [PCD_ATTR_RATE_BURST] = { "rate_burst", 0644 },
+    /* Bytes moved per turn when open files queue for the device, 0 to not queue them */
+    [PCD_ATTR_FQ_QUANTUM] = { "fq_quantum", 0644 },
+    [PCD_ATTR_RATE_THROTTLED] = { "rate_throttled", 0444 },
+    [PCD_ATTR_FQ_WAITS] = { "fq_waits", 0444 },
+    /* Count 1 in N reads and writes in the debugfs heatmap, 0 to stop counting */
+    [PCD_ATTR_HEAT_SAMPLE] = { "heat_sample", 0644 },
+    /* Heatmap counts halve this often, 0 to keep them forever */
+    [PCD_ATTR_HEAT_HALF_LIFE_MS] = { "heat_half_life_ms", 0644 },
+    /* Writes wait for PCD_IOC_COMMIT before readers see them */
+    [PCD_ATTR_DOUBLE_BUFFER] = { "double_buffer", 0644 },
+    [PCD_ATTR_BUFFER_COMMITS] = { "buffer_commits", 0444 },
+};
+
+static struct pcd_dev *pcd_attr_dev(struct device *dev, struct device_attribute *dattr, enum pcd_attr_id *id)
+{
+    struct pcd_attr *attr = container_of(dattr, struct pcd_attr, dattr);
+
+    *id = attr->id;
+    return attr->grp->to_pcd(dev);
+}
+
+static ssize_t pcd_attr_show(struct device *dev, struct device_attribute *dattr, char *buf)
+{
+    enum pcd_attr_id id;
+    struct pcd_dev *pcd = pcd_attr_dev(dev, dattr, &id);
+
+    switch (id) {
+    case PCD_ATTR_CRC_CHECKED:
+        return sysfs_emit(buf, "%lu\n", READ_ONCE(pcd->crc_checked));
+    case PCD_ATTR_CRC_MISMATCHES:
+        return sysfs_emit(buf, "%lu\n", READ_ONCE(pcd->crc_mismatches));
+    case PCD_ATTR_RATE_LIMIT:
+        return sysfs_emit(buf, "%u\n", READ_ONCE(pcd->rate_limit));
+    case PCD_ATTR_RATE_BURST:
+        return sysfs_emit(buf, "%u\n", READ_ONCE(pcd->rate_burst));
+    case PCD_ATTR_FQ_QUANTUM:
+        return sysfs_emit(buf, "%u\n", READ_ONCE(pcd->fq_quantum));
+    case PCD_ATTR_RATE_THROTTLED:
+        return sysfs_emit(buf, "%ld\n", atomic_long_read(&pcd->rate_throttled));
+    case PCD_ATTR_FQ_WAITS:
+        return sysfs_emit(buf, "%ld\n", atomic_long_read(&pcd->fq_waits));
+    case PCD_ATTR_HEAT_SAMPLE:
+        return sysfs_emit(buf, "%u\n", READ_ONCE(pcd->heat_sample));
+    case PCD_ATTR_HEAT_HALF_LIFE_MS:
+        return sysfs_emit(buf, "%u\n", READ_ONCE(pcd->heat_half_life_ms));
+    case PCD_ATTR_DOUBLE_BUFFER:
+        return sysfs_emit(buf, "%d\n", READ_ONCE(pcd->db_buf) != NULL);
+    case PCD_ATTR_BUFFER_COMMITS:
+        return sysfs_emit(buf, "%lu\n", READ_ONCE(pcd->db_commits));
+    default:
+        return -EIO;
+    }
+}
+
+static ssize_t pcd_attr_store(struct device *dev, struct device_attribute *dattr, const char *buf, size_t count)
+{
+    int rc;
+    u32 val;
+    bool on;
+    enum pcd_attr_id id;
+    struct pcd_dev *pcd = pcd_attr_dev(dev, dattr, &id);
+
+    if (id == PCD_ATTR_DOUBLE_BUFFER) {
+        rc = kstrtobool(buf, &on);
+        if (!rc)
+            rc = pcd_db_set(pcd, on);
+        return rc ? rc : count;
+    }
+
+    rc = kstrtou32(buf, 0, &val);
+    if (rc)
+        return rc;
+
+    switch (id) {
+    case PCD_ATTR_RATE_LIMIT:
+        WRITE_ONCE(pcd->rate_limit, val);
+        break;
+    case PCD_ATTR_RATE_BURST:
+        WRITE_ONCE(pcd->rate_burst, val);
+        break;
+    case PCD_ATTR_FQ_QUANTUM:
+        WRITE_ONCE(pcd->fq_quantum, val);
+        break;
+    case PCD_ATTR_HEAT_SAMPLE:
+        rc = pcd_heat_set_sample(pcd, val);
+        break;
+    case PCD_ATTR_HEAT_HALF_LIFE_MS:
+        WRITE_ONCE(pcd->heat_half_life_ms, val);
+        break;
+    default:
+        rc = -EIO;
+    }
+
+    return rc ? rc : count;
+}
+
+void pcd_attr_group_init(struct pcd_attr_group *grp, struct pcd_dev *(*to_pcd)(struct device *dev))
+{
+    int i;
+    struct pcd_attr *attr;
+
+    grp->to_pcd = to_pcd;
+
+    for (i = 0; i < PCD_ATTR_MAX; i++) {
+        attr = &grp->attrs[i];
+        sysfs_attr_init(&attr->dattr.attr);
+        attr->dattr.attr.name = pcd_attr_info[i].name;
+        attr->dattr.attr.mode = pcd_attr_info[i].mode;
+        attr->dattr.show = pcd_attr_show;
+        attr->dattr.store = pcd_attr_info[i].mode & 0200 ? pcd_attr_store : NULL;
+        attr->id = i;
+        attr->grp = grp;
+        grp->list[i] = &attr->dattr.attr;
+    }
+
+    grp->list[PCD_ATTR_MAX] = NULL;
+    grp->group.attrs = grp->list;
+}
+EXPORT_SYMBOL_GPL(pcd_attr_group_init);
+
+/* File operations */
+
+int pcd_check_permission(int dev_perm, fmode_t acc_mode)
+{
+    if (dev_perm == PERM_RDWR)
+        return 0;
+
+    if (dev_perm == PERM_RDONLY && (acc_mode & FMODE_READ) && !(acc_mode & FMODE_WRITE))
+        return 0;
+
+    if (dev_perm == PERM_WRONLY && !(acc_mode & FMODE_READ) && (acc_mode & FMODE_WRITE))
+        return 0;
+
+    return -EPERM;
+}
+EXPORT_SYMBOL_GPL(pcd_check_permission);
+
+int pcd_core_open(struct pcd_dev *pcd, struct file *fh)
+{
+    int rc;
+
+    rc = pcd_check_permission(pcd->perm, fh->f_mode);
+    if (rc)
+        return rc;
+
+    if (!pcd->ops->seekable)
+        stream_open(file_inode(fh), fh);
+
+    return 0;
+}
+EXPORT_SYMBOL_GPL(pcd_core_open);
+
+ssize_t pcd_core_read(struct pcd_dev *pcd, struct pcd_client *cl, char __user *buf, size_t count, loff_t *f_pos,
+    unsigned int f_flags)
+{
+    int rc;
+    struct iov_iter iter;
+
+    rc = import_ubuf(ITER_DEST, buf, count, &iter);
+    if (rc)
+        return rc;
+
+    return pcd_core_read_iter(pcd, cl, &iter, f_pos, f_flags);
+}
+EXPORT_SYMBOL_GPL(pcd_core_read);
+
+ssize_t pcd_core_write(struct pcd_dev *pcd, struct pcd_client *cl, const char __user *buf, size_t count, loff_t *f_pos,
+    unsigned int f_flags)
+{
+    int rc;
+    struct iov_iter iter;
+
+    rc = import_ubuf(ITER_SOURCE, (char __user *)buf, count, &iter);
+    if (rc)
+        return rc;
+
+    return pcd_core_write_iter(pcd, cl, &iter, f_pos, f_flags);
+}
+EXPORT_SYMBOL_GPL(pcd_core_write);
+
+loff_t pcd_core_llseek(struct pcd_dev *pcd, struct file *fh, loff_t f_pos, int whence)
+{
+    loff_t tmp;
+
+    if (!pcd->ops->seekable)
+        return -ESPIPE;
+
+    switch(whence) {
+    case SEEK_SET:
+        if (f_pos > pcd->size || f_pos < 0)
+            return -EINVAL;
+        fh->f_pos = f_pos;
+        break;
+    case SEEK_CUR:
+        tmp = fh->f_pos + f_pos;
+        if (tmp > pcd->size || tmp < 0)
+            return -EINVAL;
+        fh->f_pos = tmp;
+        break;
+    case SEEK_END:
+        tmp = pcd->size + f_pos;
+        if (tmp > pcd->size || tmp < 0)
+            return -EINVAL;
+        fh->f_pos = tmp;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    return fh->f_pos;
+}
+EXPORT_SYMBOL_GPL(pcd_core_llseek);
+
+/* Always take the lower addressed device lock first so that two copies
+* running in opposite directions can't deadlock */
+static void pcd_lock_pair(struct pcd_dev *a, struct pcd_dev *b)
+{
+    if (a == b) {
+        mutex_lock(&a->lock);
+        return;
+    }
+
+    if (a > b)
+        swap(a, b);
+
+    mutex_lock(&a->lock);
+    mutex_lock_nested(&b->lock, SINGLE_DEPTH_NESTING);
+}
+
+static void pcd_unlock_pair(struct pcd_dev *a, struct pcd_dev *b)
+{
+    mutex_unlock(&a->lock);
+    if (a != b)
+        mutex_unlock(&b->lock);
+}
+
+/* Move data between two devices, or within one, without bouncing it through
+* userspace. Copies a chunk at a time like read/write so large copies stay
+* preemptible. Returns the bytes copied, clamped to both device sizes. */
+ssize_t pcd_core_copy(struct pcd_dev *dst, loff_t dst_off, struct pcd_dev *src, loff_t src_off, size_t len)
+{
+    int rc = 0;
+    bool backwards;
+    size_t done = 0, chunk, off;
+
+    if (!src->ops->seekable || !dst->ops->seekable)
+        return -EINVAL;
+
+    if (src_off < 0 || dst_off < 0)
+        return -EINVAL;
+
+    if (src_off >= src->size || dst_off >= dst->size)
+        return 0;
+
+    len = min3((u64)len, (u64)src->size - src_off, (u64)dst->size - dst_off);
+
+    /* Source and destination may be the same device, an overlapping copy
+    to a higher offset has to run from the end like memmove() does */
+    backwards = src == dst && dst_off > src_off;
+
+    while (done < len) {
+        if (backwards) {
+            chunk = min(pcd_tail_len(dst_off + len - done, len - done),
+                pcd_tail_len(src_off + len - done, len - done));
+            off = len - done - chunk;
+        } else {
+            chunk = min(pcd_chunk_len(dst_off + done, len - done),
+                pcd_chunk_len(src_off + done, len - done));
+            off = done;
+        }
+
+        pcd_lock_pair(src, dst);
+
+        rc = pcd_crc_verify(src, src_off + off, chunk);
+        if (!rc)
+            rc = pcd_mem_reserve(dst, dst_off + off, chunk);
+        if (!rc) {
+            pcd_mem_move(dst, dst_off + off, src, src_off + off, chunk);
+            pcd_crc_update(dst, dst_off + off, chunk);
+            done += chunk;
+        }
+
+        pcd_unlock_pair(src, dst);
+
+        if (rc || done == len)
+            break;
+
+        cond_resched();
+
+        /* Only a prefix copied so far can be reported as partial progress */
+        if (!backwards && signal_pending(current))
+            break;
+    }
+
+    if (rc && backwards)
+        done = 0;
+
+    if (unlikely(READ_ONCE(src->heat_sample)) && done)
+        pcd_heat_record(src, src_off, done, false);
+    if (unlikely(READ_ONCE(dst->heat_sample)) && done)
+        pcd_heat_record(dst, dst_off, done, true);
+
+    return done ? done : rc;
+}
+EXPORT_SYMBOL_GPL(pcd_core_copy);
+
+/* Init and deinit */
+
+static int __init pcd_core_module_init(void)
+{
+    /* Register the shrinker that reclaims zero pages of large sparse devices */
+    pcdcore_data.shrinker = shrinker_alloc(0, "pcd");
+    if (!pcdcore_data.shrinker) {
+        /* A dedup_interval_ms given at load has already started the scan */
+        cancel_delayed_work_sync(&pcdcore_data.dedup_work);
+        pr_info("PCD core insertion failed\n");
+        return -ENOMEM;
+    }
+    pcdcore_data.shrinker->count_objects = pcd_shrink_count;
+    pcdcore_data.shrinker->scan_objects = pcd_shrink_scan;
+    shrinker_register(pcdcore_data.shrinker);
+
+    /* Per-device directories are added by the drivers */
+    pcdcore_data.debugfs = debugfs_create_dir("pcd", NULL);
+
+    pr_info("PCD core init\n");
+
+    return 0;
+}
+
+static void __exit pcd_core_module_exit(void)
+{
+    /* Driver modules depend on this one, so no devices or shared pages are left */
+    cancel_delayed_work_sync(&pcdcore_data.dedup_work);
+    shrinker_free(pcdcore_data.shrinker);
+    debugfs_remove_recursive(pcdcore_data.debugfs);
+
+    pr_info("PCD core exit\n");
+}
+
+module_init(pcd_core_module_init);
+module_exit(pcd_core_module_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Kieran");
+MODULE_DESCRIPTION("Shared data path and storage backends of the pcd drivers");
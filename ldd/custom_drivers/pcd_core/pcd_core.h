@@ -0,0 +1,292 @@
+#ifndef __PCD_CORE_H
+#define __PCD_CORE_H
+
+/* Data path shared by the pcd drivers. A driver embeds a struct pcd_dev per
+* device, fills in size, perm and sn, picks a backend with pcd_core_init() and
+* forwards its file operations to the pcd_core_*() helpers. */
+
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/xarray.h>
+#include <linux/uio.h>
+#include <linux/rcupdate.h>
+#include <linux/device.h>
+
+enum {
+    PERM_RDONLY = 0x1,
+    PERM_WRONLY = 0x10,
+    PERM_RDWR = 0x11,
+};
+
+/* Storage layouts a device buffer can have */
+enum pcd_backend {
+    PCD_BACKEND_STATIC,     /* memory provided by the driver, e.g. a static array */
+    PCD_BACKEND_LINEAR,     /* one kvmalloc() allocation */
+    PCD_BACKEND_SPARSE,     /* pages allocated on first write, zero pages are reclaimable */
+    PCD_BACKEND_RING,       /* kvmalloc() FIFO, reads consume what writes appended */
+    PCD_BACKEND_MAX
+};
+
+/* Payload of the records a synthetic source produces */
+enum pcd_src_payload {
+    PCD_SRC_COUNTER,        /* little endian u64 sequence number, then the pattern */
+    PCD_SRC_PATTERN,        /* byte i of a record holds i & 0xff */
+    PCD_SRC_PAYLOAD_MAX
+};
+
+struct pcd_dev;
+struct pcd_src;
+
+/* Each backend gets its own copy of the read/write path with the storage access
+* inlined, the only indirect call is the one through this table per syscall */
+struct pcd_backend_ops {
+    const char *name;
+    bool seekable;
+    int (*init)(struct pcd_dev *pcd, void *mem);
+    void (*free)(struct pcd_dev *pcd);
+    void (*clear)(struct pcd_dev *pcd);
+    ssize_t (*read)(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos, unsigned int f_flags);
+    ssize_t (*write)(struct pcd_dev *pcd, struct iov_iter *from, loff_t *f_pos, unsigned int f_flags);
+};
+
+struct pcd_dev {
+    /* Filled in by the driver before pcd_core_init() */
+    size_t size;
+    int perm;
+    const char *sn;
+
+    enum pcd_backend backend;
+    const struct pcd_backend_ops *ops;
+    struct mutex lock;
+
+    /* Static, linear and ring backends */
+    char *mem;
+
+    /* Double buffering, see pcd_db_set(). Reads come from db_live without taking
+    * pcd->lock while everything else works on mem, the shadow, until a commit.
+    * db_buf holds two buffers, db_mem is the backend's own one. */
+    char __rcu *db_live;
+    char *db_buf;
+    char *db_spare;
+    char *db_mem;
+    struct mutex db_lock;
+    unsigned long db_commits;
+    bool db_blocked;        /* set by the driver, under lock, while its reads bypass db_live */
+
+    /* Sparse backend, counts are in pages */
+    struct xarray pages;
+    unsigned long nr_pages;
+    struct list_head node;
+    unsigned long resident;
+    unsigned long unscanned;
+    unsigned long min_resident;
+    unsigned long reclaim_cursor;
+    unsigned long reclaimed;
+    unsigned long shared;           /* slots pointing at a page in the dedup table */
+    unsigned long dedup_cursor;
+
+    /* Ring backend, bytes held start at ring_head */
+    size_t ring_head;
+    size_t ring_len;
+    wait_queue_head_t ring_readers;
+    wait_queue_head_t ring_writers;
+
+    /* Synthetic source filling the ring, see pcd_src_start(). The rate is picked
+    * up on the fly, record size and payload when the source starts. */
+    u32 src_rate;           /* records per second */
+    u32 src_rec_size;       /* bytes per record */
+    u32 src_payload;        /* enum pcd_src_payload */
+    struct pcd_src *src;
+    u64 src_records;        /* generated so far, dropped ones included */
+    unsigned long src_overruns;
+
+    /* Block checksums, NULL unless pcd_crc_init() was called */
+    u32 *crc;
+    unsigned long crc_checked;
+    unsigned long crc_mismatches;
+
+    /* Access heatmap, see pcd_heat_record(). NULL until pcd_heat_set_sample() turns it on */
+    u32 heat_sample;        /* 1 in heat_sample reads and writes is counted, 0 for none */
+    u32 heat_half_life_ms;  /* counts halve this often, 0 to keep them */
+    spinlock_t heat_lock;
+    struct pcd_heat_region *heat;
+    u64 heat_decay_ns;
+    struct dentry *debugfs;
+
+    /* Scheduling between open files, see pcd_sched_rw(). Zero turns each part off */
+    u32 rate_limit;         /* bytes per second, per open file */
+    u32 rate_burst;         /* bucket depth in bytes, 0 for one second worth */
+    u32 fq_quantum;         /* bytes moved per turn */
+    spinlock_t fq_lock;
+    struct list_head fq_queue;
+    atomic_long_t rate_throttled;
+    atomic_long_t fq_waits;
+};
+
+/* Page dedup across all sparse devices, switched on with the dedup_interval_ms
+* parameter of pcd_core. Counts are in pages. */
+struct pcd_dedup_stats {
+    unsigned long shared;   /* distinct pages mapped by more than one slot */
+    unsigned long mapped;   /* device slots pointing at them */
+    unsigned long zero;     /* zero filled pages dropped by the scan */
+    unsigned long cow;      /* shared pages copied on write */
+};
+
+/* sysfs attributes every pcd driver has, parsed and checked in pcd_core */
+enum pcd_attr_id {
+    PCD_ATTR_CRC_CHECKED,
+    PCD_ATTR_CRC_MISMATCHES,
+    PCD_ATTR_RATE_LIMIT,
+    PCD_ATTR_RATE_BURST,
+    PCD_ATTR_FQ_QUANTUM,
+    PCD_ATTR_RATE_THROTTLED,
+    PCD_ATTR_FQ_WAITS,
+    PCD_ATTR_HEAT_SAMPLE,
+    PCD_ATTR_HEAT_HALF_LIFE_MS,
+    PCD_ATTR_DOUBLE_BUFFER,
+    PCD_ATTR_BUFFER_COMMITS,
+    PCD_ATTR_MAX
+};
+
+struct pcd_attr_group;
+
+struct pcd_attr {
+    struct device_attribute dattr;
+    enum pcd_attr_id id;
+    struct pcd_attr_group *grp;
+};
+
+/* One per driver, filled in by pcd_attr_group_init(). to_pcd maps a device of
+* the driver to its pcd_dev, group goes in the groups of those devices. */
+struct pcd_attr_group {
+    struct pcd_dev *(*to_pcd)(struct device *dev);
+    struct attribute_group group;
+    struct pcd_attr attrs[PCD_ATTR_MAX];
+    struct attribute *list[PCD_ATTR_MAX + 1];
+};
+
+/* Per-open scheduling state, embedded in whatever the driver keeps per open file */
+struct pcd_client {
+    spinlock_t lock;
+    u64 tokens;
+    u64 last_ns;
+};
+
+static inline void pcd_client_init(struct pcd_client *cl)
+{
+    spin_lock_init(&cl->lock);
+    cl->tokens = 0;
+    cl->last_ns = 0;
+}
+
+int pcd_backend_parse(const char *buf);
+const char *pcd_backend_name(enum pcd_backend backend);
+
+int pcd_core_init(struct pcd_dev *pcd, enum pcd_backend backend, void *mem);
+void pcd_core_free(struct pcd_dev *pcd);
+void pcd_core_clear(struct pcd_dev *pcd);
+
+void pcd_attr_group_init(struct pcd_attr_group *grp, struct pcd_dev *(*to_pcd)(struct device *dev));
+
+int pcd_check_permission(int dev_perm, fmode_t acc_mode);
+/* Reads and writes are scheduled against the other open files when a client
+* is passed, a NULL client goes straight to the backend */
+int pcd_core_open(struct pcd_dev *pcd, struct file *fh);
+ssize_t pcd_core_read(struct pcd_dev *pcd, struct pcd_client *cl, char __user *buf, size_t count, loff_t *f_pos,
+    unsigned int f_flags);
+ssize_t pcd_core_write(struct pcd_dev *pcd, struct pcd_client *cl, const char __user *buf, size_t count, loff_t *f_pos,
+    unsigned int f_flags);
+loff_t pcd_core_llseek(struct pcd_dev *pcd, struct file *fh, loff_t f_pos, int whence);
+ssize_t pcd_core_copy(struct pcd_dev *dst, loff_t dst_off, struct pcd_dev *src, loff_t src_off, size_t len);
+
+ssize_t pcd_sched_rw(struct pcd_dev *pcd, struct pcd_client *cl, struct iov_iter *iter, loff_t *f_pos,
+    unsigned int f_flags, bool write);
+void pcd_heat_record(struct pcd_dev *pcd, loff_t pos, size_t count, bool write);
+ssize_t pcd_db_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos, unsigned int f_flags);
+
+/* Double buffered devices are read from the committed version, the others from the backend */
+static inline ssize_t pcd_backend_read(struct pcd_dev *pcd, struct iov_iter *to, loff_t *f_pos,
+    unsigned int f_flags)
+{
+    if (rcu_access_pointer(pcd->db_live))
+        return pcd_db_read(pcd, to, f_pos, f_flags);
+
+    return pcd->ops->read(pcd, to, f_pos, f_flags);
+}
+
+static inline bool pcd_sched_active(struct pcd_dev *pcd, struct pcd_client *cl)
+{
+    return cl && (READ_ONCE(pcd->rate_limit) || READ_ONCE(pcd->fq_quantum));
+}
+
+static inline ssize_t pcd_core_read_iter(struct pcd_dev *pcd, struct pcd_client *cl, struct iov_iter *to,
+    loff_t *f_pos, unsigned int f_flags)
+{
+    loff_t pos = *f_pos;
+    ssize_t ret;
+
+    if (pcd_sched_active(pcd, cl))
+        ret = pcd_sched_rw(pcd, cl, to, f_pos, f_flags, false);
+    else
+        ret = pcd_backend_read(pcd, to, f_pos, f_flags);
+
+    if (unlikely(READ_ONCE(pcd->heat_sample)) && ret > 0)
+        pcd_heat_record(pcd, pos, ret, false);
+
+    return ret;
+}
+
+static inline ssize_t pcd_core_write_iter(struct pcd_dev *pcd, struct pcd_client *cl, struct iov_iter *from,
+    loff_t *f_pos, unsigned int f_flags)
+{
+    loff_t pos = *f_pos;
+    ssize_t ret;
+
+    if (pcd_sched_active(pcd, cl))
+        ret = pcd_sched_rw(pcd, cl, from, f_pos, f_flags, true);
+    else
+        ret = pcd->ops->write(pcd, from, f_pos, f_flags);
+
+    if (unlikely(READ_ONCE(pcd->heat_sample)) && ret > 0)
+        pcd_heat_record(pcd, pos, ret, true);
+
+    return ret;
+}
+
+/* Byte range access for drivers layering formats on top of the buffer. Positional
+* backends only, callers hold pcd->lock and reserve a range before writing it. */
+int pcd_mem_reserve(struct pcd_dev *pcd, loff_t pos, size_t count);
+void pcd_mem_read(struct pcd_dev *pcd, loff_t pos, void *dst, size_t count);
+void pcd_mem_write(struct pcd_dev *pcd, loff_t pos, const void *src, size_t count);
+size_t pcd_mem_to_user(struct pcd_dev *pcd, loff_t pos, char __user *buf, size_t count);
+size_t pcd_mem_from_user(struct pcd_dev *pcd, loff_t pos, const char __user *buf, size_t count);
+
+/* Checksums, callers hold pcd->lock */
+int pcd_crc_init(struct pcd_dev *pcd);
+void pcd_crc_update(struct pcd_dev *pcd, loff_t pos, size_t count);
+int pcd_crc_verify(struct pcd_dev *pcd, loff_t pos, size_t count);
+
+void pcd_dedup_stats(struct pcd_dedup_stats *st);
+
+/* Synthetic source of ring devices, a kthread producing records at src_rate */
+int pcd_src_payload_parse(const char *buf);
+const char *pcd_src_payload_name(u32 payload);
+int pcd_src_start(struct pcd_dev *pcd);
+void pcd_src_stop(struct pcd_dev *pcd);
+
+/* Double buffering of static and linear devices. Writes land in a shadow copy
+* and pcd_db_commit() publishes it to readers in one step. */
+int pcd_db_set(struct pcd_dev *pcd, bool on);
+int pcd_db_commit(struct pcd_dev *pcd);
+
+/* Access heatmap, published in debugfs under pcd/<name>/heatmap */
+int pcd_heat_set_sample(struct pcd_dev *pcd, u32 sample);
+void pcd_core_debugfs_add(struct pcd_dev *pcd, const char *name);
+void pcd_core_debugfs_remove(struct pcd_dev *pcd);
+
+#endif /* #ifndef __PCD_CORE_H */
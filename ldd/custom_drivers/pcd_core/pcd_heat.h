@@ -0,0 +1,31 @@
+#ifndef __PCD_HEAT_H
+#define __PCD_HEAT_H
+
+/* Layout of the debugfs heatmap file, /sys/kernel/debug/pcd/<device>/heatmap.
+* Shared between pcd_core and the userspace tools rendering it. */
+
+#include <linux/types.h>
+
+#define PCD_HEAT_MAGIC          0x48444350      /* "PCDH" */
+#define PCD_HEAT_VERSION        1
+#define PCD_HEAT_REGION_SIZE    4096
+
+/* Counts are of sampled accesses touching the region. Scaled by sample they
+* estimate the real number, decayed by half every half_life_ms. */
+struct pcd_heat_region {
+    __u32 reads;
+    __u32 writes;
+};
+
+struct pcd_heat_hdr {
+    __u32 magic;
+    __u32 version;
+    __u32 region_size;      /* bytes covered by each region */
+    __u32 sample;           /* 1 in sample reads and writes was counted, 0 while off */
+    __u32 half_life_ms;     /* 0 when counts never decay */
+    __u32 reserved;
+    __u64 dev_size;
+    __u64 nr_regions;       /* struct pcd_heat_region entries following the header */
+};
+
+#endif /* #ifndef __PCD_HEAT_H */
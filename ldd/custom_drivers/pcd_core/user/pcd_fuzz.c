@@ -0,0 +1,625 @@
+/*
+ * libFuzzer harness for the pcd data path.
+ *
+ * The input sets up two devices, backend and size each, then runs a sequence
+ * of reads, writes, seeks, copies, clears, reclaim rounds, dedup passes,
+ * scheduler and heatmap changes and double buffer commits against them. A
+ * shadow copy of every buffer predicts each return value and checks every
+ * byte read back. Positions and counts stay within
+ * what the VFS hands a driver: non-negative, and pos + count doesn't overflow.
+ *
+ *	make user
+ *	./user/pcd_fuzz -max_len=4096 corpus/
+ *
+ * Built with PCD_FUZZ_STANDALONE it replays the files named on the command
+ * line instead, or runs random inputs when given none. That build needs no
+ * clang, e.g. to reproduce a crash under gdb.
+ */
+#include "pcd_core.h"
+#include "pcd_heat.h"
+
+#define NR_DEVS		2
+#define MAX_DEV_SIZE	(128UL << 10)
+#define MAX_XFER	(MAX_DEV_SIZE + PAGE_SIZE)
+
+enum {
+	OP_READ,
+	OP_PREAD,
+	OP_WRITE,
+	OP_PWRITE,
+	OP_SEEK,
+	OP_COPY,
+	OP_CLEAR,
+	OP_SHRINK,
+	OP_MIN_RESIDENT,
+	OP_SCHED,
+	OP_DEDUP,
+	OP_DOUBLE_BUFFER,
+	OP_MAX
+};
+
+struct fuzz_dev {
+	struct pcd_dev pcd;
+	struct pcd_client client;
+	struct file fh;
+	char *static_mem;
+	/* Expected contents. Rings keep what is queued, oldest first */
+	u8 *shadow;
+	size_t shadow_len;
+	/* What readers see while double buffered, shadow then holds the pending writes */
+	u8 *committed;
+};
+
+struct fuzz_input {
+	const u8 *data;
+	size_t size;
+};
+
+static const char *const dev_names[NR_DEVS] = { "dev0", "dev1" };
+static u8 xfer_buf[MAX_XFER];
+static u8 pattern_buf[MAX_XFER];
+/* Repeats every page, writes from it leave identical pages for the dedup scan */
+static u8 template_buf[MAX_XFER + PAGE_SIZE];
+
+#define fuzz_assert(cond)							\
+	do {									\
+		if (!(cond)) {							\
+			fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);	\
+			abort();						\
+		}								\
+	} while (0)
+
+static u64 next_bytes(struct fuzz_input *in, int n)
+{
+	u64 v = 0;
+
+	while (n--) {
+		v <<= 8;
+		if (in->size) {
+			v |= *in->data++;
+			in->size--;
+		}
+	}
+
+	return v;
+}
+
+static u8 next_u8(struct fuzz_input *in) { return next_bytes(in, 1); }
+static u32 next_u32(struct fuzz_input *in) { return next_bytes(in, 4); }
+
+/* Mostly around the device, sometimes at the far end of the offset range */
+static loff_t next_pos(struct fuzz_input *in, struct fuzz_dev *d, size_t count)
+{
+	u32 v = next_u32(in);
+
+	if ((v & 0xf) == 0xf)
+		return LLONG_MAX - count - (v >> 4) % PAGE_SIZE;
+
+	return (v >> 4) % (d->pcd.size * 2 + 2);
+}
+
+static size_t next_count(struct fuzz_input *in)
+{
+	u32 v = next_u32(in);
+
+	/* Small transfers are where the chunk edges are, weight them */
+	if (v & 1)
+		return (v >> 1) % (2 * PAGE_SIZE + 2);
+
+	return (v >> 1) % (MAX_XFER + 1);
+}
+
+static int dev_init(struct fuzz_dev *d, struct fuzz_input *in, const char *name)
+{
+	enum pcd_backend backend = next_u8(in) % PCD_BACKEND_MAX;
+	/* Hashing dominates the run time, checksum one device in four */
+	bool crc = !(next_u8(in) & 3);
+	int rc;
+
+	memset(d, 0, sizeof(*d));
+	d->pcd.size = next_u32(in) % MAX_DEV_SIZE + 1;
+	d->pcd.perm = PERM_RDWR;
+	d->pcd.sn = "fuzz";
+
+	d->shadow = calloc(1, d->pcd.size);
+	if (backend == PCD_BACKEND_STATIC)
+		d->static_mem = calloc(1, d->pcd.size);
+
+	rc = pcd_core_init(&d->pcd, backend, d->static_mem);
+	fuzz_assert(!rc);
+
+	if (crc) {
+		mutex_lock(&d->pcd.lock);
+		rc = pcd_crc_init(&d->pcd);
+		mutex_unlock(&d->pcd.lock);
+		fuzz_assert(!rc);
+	}
+
+	pcd_core_debugfs_add(&d->pcd, name);
+
+	pcd_client_init(&d->client);
+	d->fh.f_mode = FMODE_READ | FMODE_WRITE;
+	d->fh.f_flags = O_RDWR | O_NONBLOCK;
+	fuzz_assert(!pcd_core_open(&d->pcd, &d->fh));
+
+	return 0;
+}
+
+static void dev_free(struct fuzz_dev *d)
+{
+	pcd_core_free(&d->pcd);
+	free(d->static_mem);
+	free(d->shadow);
+	free(d->committed);
+}
+
+/* A rate limit makes progress depend on the clock, only a prefix is promised then */
+static void check_ret(struct fuzz_dev *d, ssize_t ret, ssize_t expected)
+{
+	if (READ_ONCE(d->pcd.rate_limit) && (ret == -EAGAIN || (ret > 0 && ret <= expected)))
+		return;
+
+	if (ret != expected)
+		fprintf(stderr, "%s on %s: got %zd, expected %zd\n", pcd_backend_name(d->pcd.backend),
+			d->pcd.sn, ret, expected);
+	fuzz_assert(ret == expected);
+}
+
+static void op_read(struct fuzz_dev *d, struct fuzz_input *in, bool positional)
+{
+	size_t count = next_count(in);
+	loff_t pos = positional ? next_pos(in, d, count) : d->fh.f_pos;
+	loff_t new_pos = pos;
+	ssize_t ret, expected;
+	const u8 *seen = d->committed ? d->committed : d->shadow;
+
+	ret = pcd_core_read(&d->pcd, &d->client, (char *)xfer_buf, count, &new_pos, d->fh.f_flags);
+
+	if (!d->pcd.ops->seekable) {
+		expected = !count ? 0 : !d->shadow_len ? -EAGAIN : (ssize_t)min(count, d->shadow_len);
+		check_ret(d, ret, expected);
+		if (ret > 0) {
+			fuzz_assert(!memcmp(xfer_buf, d->shadow, ret));
+			memmove(d->shadow, d->shadow + ret, d->shadow_len - ret);
+			d->shadow_len -= ret;
+		}
+		return;
+	}
+
+	expected = pos < d->pcd.size ? (ssize_t)min(count, d->pcd.size - pos) : 0;
+	check_ret(d, ret, expected);
+	if (ret > 0) {
+		fuzz_assert(!memcmp(xfer_buf, seen + pos, ret));
+		fuzz_assert(new_pos == pos + ret);
+	} else {
+		fuzz_assert(new_pos == pos);
+	}
+
+	if (!positional)
+		d->fh.f_pos = new_pos;
+}
+
+static void op_write(struct fuzz_dev *d, struct fuzz_input *in, bool positional)
+{
+	size_t count = next_count(in);
+	loff_t pos = positional ? next_pos(in, d, count) : d->fh.f_pos;
+	loff_t new_pos = pos;
+	u32 sel = next_u32(in);
+	const u8 *src = pattern_buf + sel % (MAX_XFER - count + 1);
+	ssize_t ret, expected, room;
+
+	/* Lined up with the page so every page written gets the same data */
+	if (!(sel & 0xf))
+		src = template_buf + offset_in_page(pos);
+
+	ret = pcd_core_write(&d->pcd, &d->client, (const char *)src, count, &new_pos, d->fh.f_flags);
+
+	if (!d->pcd.ops->seekable) {
+		room = d->pcd.size - d->shadow_len;
+		expected = !count ? 0 : !room ? -EAGAIN : (ssize_t)min((ssize_t)count, room);
+		check_ret(d, ret, expected);
+		if (ret > 0) {
+			memcpy(d->shadow + d->shadow_len, src, ret);
+			d->shadow_len += ret;
+		}
+		return;
+	}
+
+	/* Writing at or past the end has always been -ENOMEM, zero byte writes included */
+	expected = pos < d->pcd.size ? (ssize_t)min(count, d->pcd.size - pos) : 0;
+	if (!expected)
+		expected = -ENOMEM;
+	check_ret(d, ret, expected);
+	if (ret > 0) {
+		memcpy(d->shadow + pos, src, ret);
+		fuzz_assert(new_pos == pos + ret);
+	} else {
+		fuzz_assert(new_pos == pos);
+	}
+
+	if (!positional)
+		d->fh.f_pos = new_pos;
+}
+
+static void op_seek(struct fuzz_dev *d, struct fuzz_input *in)
+{
+	int whence = next_u8(in) % 4;
+	loff_t off = (s64)(int32_t)next_u32(in) % (loff_t)(d->pcd.size * 2 + 2);
+	loff_t old = d->fh.f_pos, base, expected;
+	loff_t ret;
+
+	/* Sometimes far enough to overflow the sum */
+	if (next_u8(in) == 0xff)
+		off = off < 0 ? LLONG_MIN + off : LLONG_MAX - off;
+
+	ret = pcd_core_llseek(&d->pcd, &d->fh, off, whence);
+
+	if (!d->pcd.ops->seekable) {
+		fuzz_assert(ret == -ESPIPE);
+		return;
+	}
+
+	base = whence == SEEK_SET ? 0 : whence == SEEK_CUR ? old : (loff_t)d->pcd.size;
+	expected = base + off;
+	if (whence > SEEK_END || expected < 0 || expected > (loff_t)d->pcd.size ||
+	    (off > 0 && expected < base) || (off < 0 && expected > base)) {
+		fuzz_assert(ret == -EINVAL);
+		fuzz_assert(d->fh.f_pos == old);
+		return;
+	}
+
+	fuzz_assert(ret == expected);
+	fuzz_assert(d->fh.f_pos == expected);
+}
+
+static void op_copy(struct fuzz_dev *devs, struct fuzz_input *in)
+{
+	u8 sel = next_u8(in);
+	struct fuzz_dev *src = &devs[sel & 1], *dst = &devs[(sel >> 1) & 1];
+	size_t len = next_count(in);
+	loff_t src_off = next_pos(in, src, 0), dst_off = next_pos(in, dst, 0);
+	ssize_t ret, expected;
+
+	ret = pcd_core_copy(&dst->pcd, dst_off, &src->pcd, src_off, len);
+
+	if (!src->pcd.ops->seekable || !dst->pcd.ops->seekable) {
+		fuzz_assert(ret == -EINVAL);
+		return;
+	}
+
+	if (src_off >= (loff_t)src->pcd.size || dst_off >= (loff_t)dst->pcd.size)
+		expected = 0;
+	else
+		expected = min3(len, src->pcd.size - src_off, dst->pcd.size - dst_off);
+
+	fuzz_assert(ret == expected);
+	if (ret > 0)
+		memmove(dst->shadow + dst_off, src->shadow + src_off, ret);
+}
+
+static void op_clear(struct fuzz_dev *d)
+{
+	mutex_lock(&d->pcd.lock);
+	pcd_core_clear(&d->pcd);
+	mutex_unlock(&d->pcd.lock);
+
+	memset(d->shadow, 0, d->pcd.size);
+	d->shadow_len = 0;
+}
+
+static void op_sched(struct fuzz_dev *d, struct fuzz_input *in)
+{
+	u8 sel = next_u8(in);
+	u32 val = next_u32(in);
+
+	switch (sel % 5) {
+	case 0:
+		WRITE_ONCE(d->pcd.fq_quantum, val % (2 * PAGE_SIZE + 1));
+		break;
+	case 1:
+		WRITE_ONCE(d->pcd.rate_limit, val);
+		break;
+	case 2:
+		WRITE_ONCE(d->pcd.rate_burst, val % (MAX_XFER + 1));
+		break;
+	case 3:
+		fuzz_assert(pcd_heat_set_sample(&d->pcd, val % 4) == (d->pcd.ops->seekable ? 0 : -EOPNOTSUPP));
+		break;
+	case 4:
+		/* Short enough to decay within a run */
+		WRITE_ONCE(d->pcd.heat_half_life_ms, val % 3);
+		break;
+	}
+}
+
+/* Only static and linear devices without checksums can be double buffered */
+static void op_double_buffer(struct fuzz_dev *d, struct fuzz_input *in)
+{
+	bool able = (d->pcd.backend == PCD_BACKEND_STATIC || d->pcd.backend == PCD_BACKEND_LINEAR);
+	int rc;
+
+	switch (next_u8(in) % 3) {
+	case 0:
+		rc = pcd_db_set(&d->pcd, true);
+		fuzz_assert(rc == (!able ? -EOPNOTSUPP : d->pcd.crc ? -EBUSY : 0));
+		if (!rc && !d->committed) {
+			d->committed = malloc(d->pcd.size);
+			memcpy(d->committed, d->shadow, d->pcd.size);
+		}
+		break;
+	case 1:
+		/* Pending writes are published, the backend is back on its own buffer */
+		fuzz_assert(!pcd_db_set(&d->pcd, false));
+		fuzz_assert(!d->pcd.db_buf && !rcu_access_pointer(d->pcd.db_live));
+		fuzz_assert(d->pcd.backend != PCD_BACKEND_STATIC || d->pcd.mem == d->static_mem);
+		free(d->committed);
+		d->committed = NULL;
+		break;
+	case 2:
+		rc = pcd_db_commit(&d->pcd);
+		fuzz_assert(rc == (d->committed ? 0 : -EINVAL));
+		if (!rc)
+			memcpy(d->committed, d->shadow, d->pcd.size);
+		break;
+	}
+}
+
+/* Sparse page accounting has to match what is actually in the xarray.
+* XA_MARK_0 is PCD_PAGE_UNSCANNED in pcd_core.c, XA_MARK_2 PCD_PAGE_SHARED. */
+static void check_sparse(struct fuzz_dev *d)
+{
+	unsigned long i, resident = 0, unscanned = 0, shared = 0;
+	struct page *page;
+
+	xa_for_each(&d->pcd.pages, i, page) {
+		fuzz_assert(i < d->pcd.nr_pages);
+		resident++;
+		if (xa_get_mark(&d->pcd.pages, i, XA_MARK_0))
+			unscanned++;
+		if (xa_get_mark(&d->pcd.pages, i, XA_MARK_2)) {
+			fuzz_assert(page_private(page));
+			shared++;
+		} else {
+			fuzz_assert(page_count(page) == 1);
+		}
+	}
+
+	fuzz_assert(resident == d->pcd.resident);
+	fuzz_assert(unscanned == d->pcd.unscanned);
+	fuzz_assert(shared == d->pcd.shared);
+}
+
+/* The heatmap snapshot has to describe the device, read it back in two parts */
+static void check_heat(struct fuzz_dev *d, const char *name)
+{
+	const struct file_operations *fops;
+	struct pcd_heat_hdr hdr;
+	struct inode inode;
+	struct file fh;
+	size_t len, nr = DIV_ROUND_UP(d->pcd.size, PCD_HEAT_REGION_SIZE);
+	u8 *buf;
+
+	fuzz_assert(!pcd_user_debugfs_open(name, "heatmap", &inode, &fh, &fops));
+
+	len = sizeof(hdr) + nr * sizeof(struct pcd_heat_region);
+	buf = malloc(len + 1);
+	fuzz_assert(fops->read(&fh, (char *)buf, sizeof(hdr) / 2, &fh.f_pos) == sizeof(hdr) / 2);
+	fuzz_assert(fops->read(&fh, (char *)buf + sizeof(hdr) / 2, len, &fh.f_pos) == (ssize_t)(len - sizeof(hdr) / 2));
+	fuzz_assert(fops->read(&fh, (char *)buf, 1, &fh.f_pos) == 0);
+
+	memcpy(&hdr, buf, sizeof(hdr));
+	fuzz_assert(hdr.magic == PCD_HEAT_MAGIC && hdr.version == PCD_HEAT_VERSION);
+	fuzz_assert(hdr.region_size == PCD_HEAT_REGION_SIZE);
+	fuzz_assert(hdr.dev_size == d->pcd.size && hdr.nr_regions == nr);
+	fuzz_assert(hdr.sample == d->pcd.heat_sample);
+
+	fops->release(&inode, &fh);
+	free(buf);
+}
+
+/* Read everything back with plain unscheduled reads and compare */
+static void check_dev(struct fuzz_dev *d)
+{
+	struct iov_iter iter;
+	loff_t pos = 0;
+	ssize_t ret;
+	u8 *buf = malloc(d->pcd.size);
+
+	if (d->pcd.backend == PCD_BACKEND_SPARSE)
+		check_sparse(d);
+
+	import_ubuf(ITER_DEST, buf, d->pcd.size, &iter);
+	ret = pcd_core_read_iter(&d->pcd, NULL, &iter, &pos, O_NONBLOCK);
+
+	if (d->pcd.ops->seekable) {
+		fuzz_assert(ret == (ssize_t)d->pcd.size);
+		fuzz_assert(!memcmp(buf, d->committed ? d->committed : d->shadow, d->pcd.size));
+	} else {
+		fuzz_assert(ret == (d->shadow_len ? (ssize_t)d->shadow_len : -EAGAIN));
+		fuzz_assert(ret < 0 || !memcmp(buf, d->shadow, ret));
+	}
+
+	fuzz_assert(!d->pcd.crc_mismatches);
+	free(buf);
+}
+
+/* Pages with data of their own end up in the dedup table but nothing is shared,
+* rewriting them must not copy. Runs once, before any input. */
+static void check_dedup_unique(void)
+{
+	struct pcd_dedup_stats before, st;
+	struct pcd_dev pcd = { .size = 8 * PAGE_SIZE, .perm = PERM_RDWR, .sn = "unique" };
+	loff_t pos = 0;
+
+	fuzz_assert(!pcd_core_init(&pcd, PCD_BACKEND_SPARSE, NULL));
+	fuzz_assert(pcd_core_write(&pcd, NULL, (char *)pattern_buf, pcd.size, &pos, 0) == (ssize_t)pcd.size);
+
+	/* The first pass only clears the written marks */
+	pcd_dedup_stats(&before);
+	pcd_user_run_work();
+	pcd_user_run_work();
+	fuzz_assert(pcd.shared == 8);
+
+	pos = 0;
+	fuzz_assert(pcd_core_write(&pcd, NULL, (char *)pattern_buf, pcd.size, &pos, 0) == (ssize_t)pcd.size);
+	pcd_dedup_stats(&st);
+	fuzz_assert(st.cow == before.cow && !st.shared && !st.mapped);
+	fuzz_assert(!pcd.shared && pcd.resident == 8);
+
+	pcd_core_free(&pcd);
+}
+
+/* Zero filled pages of a sparse device go back under memory pressure. Runs once,
+* before any input. */
+static void check_reclaim_zero(void)
+{
+	static const u8 zero[16 * PAGE_SIZE];
+	struct pcd_dev pcd = { .size = sizeof(zero), .perm = PERM_RDWR, .sn = "reclaim" };
+	loff_t pos = 0;
+
+	fuzz_assert(!pcd_core_init(&pcd, PCD_BACKEND_SPARSE, NULL));
+	fuzz_assert(pcd_core_write(&pcd, NULL, (char *)zero, pcd.size, &pos, 0) == (ssize_t)pcd.size);
+	fuzz_assert(pcd.resident == 16);
+
+	fuzz_assert(pcd_user_shrink(16) == 16);
+	fuzz_assert(!pcd.resident && pcd.reclaimed == 16);
+
+	pcd_core_free(&pcd);
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size)
+{
+	static bool initialized;
+	struct fuzz_input in = { .data = data, .size = size };
+	struct fuzz_dev devs[NR_DEVS];
+	struct pcd_dedup_stats st;
+	struct fuzz_dev *d;
+	unsigned int i;
+	u8 op;
+
+	if (!initialized) {
+		fuzz_assert(!pcd_user_init());
+		fuzz_assert(!pcd_user_param_dedup_interval_ms("1"));
+		for (i = 0; i < MAX_XFER; i++)
+			pattern_buf[i] = i * 7 + (i >> 8) + 1;
+		for (i = 0; i < sizeof(template_buf); i++)
+			template_buf[i] = offset_in_page(i) * 13 + 5;
+		check_dedup_unique();
+		check_reclaim_zero();
+		initialized = true;
+	}
+
+	for (i = 0; i < NR_DEVS; i++)
+		dev_init(&devs[i], &in, dev_names[i]);
+
+	while (in.size) {
+		op = next_u8(&in);
+		d = &devs[(op >> 7) & 1];
+
+		switch (op % OP_MAX) {
+		case OP_READ:
+		case OP_PREAD:
+			op_read(d, &in, op % OP_MAX == OP_PREAD);
+			break;
+		case OP_WRITE:
+		case OP_PWRITE:
+			op_write(d, &in, op % OP_MAX == OP_PWRITE);
+			break;
+		case OP_SEEK:
+			op_seek(d, &in);
+			break;
+		case OP_COPY:
+			op_copy(devs, &in);
+			break;
+		case OP_CLEAR:
+			op_clear(d);
+			break;
+		case OP_SHRINK:
+			pcd_user_shrink(next_u8(&in));
+			break;
+		case OP_MIN_RESIDENT:
+			WRITE_ONCE(d->pcd.min_resident, next_u8(&in) % (d->pcd.nr_pages + 2));
+			break;
+		case OP_SCHED:
+			op_sched(d, &in);
+			break;
+		case OP_DEDUP:
+			pcd_user_run_work();
+			break;
+		case OP_DOUBLE_BUFFER:
+			op_double_buffer(d, &in);
+			break;
+		}
+	}
+
+	/* Every slot pointing at a shared page is one of ours */
+	pcd_dedup_stats(&st);
+	fuzz_assert(st.mapped <= devs[0].pcd.shared + devs[1].pcd.shared);
+	fuzz_assert(st.shared * 2 <= st.mapped);
+
+	for (i = 0; i < NR_DEVS; i++) {
+		check_dev(&devs[i]);
+		check_heat(&devs[i], dev_names[i]);
+		dev_free(&devs[i]);
+	}
+
+	pcd_dedup_stats(&st);
+	fuzz_assert(!st.shared && !st.mapped);
+
+	return 0;
+}
+
+#ifdef PCD_FUZZ_STANDALONE
+static int run_file(const char *path)
+{
+	FILE *f = fopen(path, "rb");
+	static u8 buf[1 << 20];
+	size_t len;
+
+	if (!f) {
+		perror(path);
+		return 1;
+	}
+
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	return LLVMFuzzerTestOneInput(buf, len);
+}
+
+/* Random inputs, the seed is printed so a failure can be rerun */
+static int run_random(unsigned long runs, unsigned int seed)
+{
+	static u8 buf[4096];
+	unsigned long r;
+	size_t len, i;
+
+	printf("pcd_fuzz: %lu random runs, seed %u\n", runs, seed);
+	srand(seed);
+
+	for (r = 0; r < runs; r++) {
+		len = rand() % sizeof(buf);
+		for (i = 0; i < len; i++)
+			buf[i] = rand();
+		LLVMFuzzerTestOneInput(buf, len);
+	}
+
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int i, rc = 0;
+	char *runs = getenv("PCD_FUZZ_RUNS");
+	char *seed = getenv("PCD_FUZZ_SEED");
+
+	if (argc < 2)
+		return run_random(runs ? strtoul(runs, NULL, 0) : 10000,
+			seed ? strtoul(seed, NULL, 0) : (unsigned int)time(NULL));
+
+	for (i = 1; i < argc; i++)
+		rc |= run_file(argv[i]);
+
+	return rc;
+}
+#endif
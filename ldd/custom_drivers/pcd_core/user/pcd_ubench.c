@@ -0,0 +1,220 @@
+/*
+ * Microbenchmark of the pcd data path built in userspace, see pcd_user.h.
+ *
+ * For each backend and transfer size from 64 B to 1 MB the device is written
+ * and read through pcd_core_write()/pcd_core_read(), the same calls the
+ * drivers make from their file operations. Rings are measured as a write
+ * followed by a read of the same size. A ring fed by the synthetic source is
+ * then drained at increasing source rates, reporting what a reader keeps up
+ * with. Run it under perf to profile the copy loops without a board, e.g.
+ *	make user
+ *	perf record -g ./user/pcd_ubench
+ *	./user/pcd_ubench 4194304 65536		(device size, fq_quantum)
+ */
+#include "pcd_core.h"
+
+#define MIN_XFER	64UL
+#define MAX_XFER	(1UL << 20)
+#define BYTES_PER_RUN	(256UL << 20)
+#define SEEKS_PER_RUN	(1UL << 22)
+#define SRC_REC_SIZE	64U
+#define SRC_RUN_NS	(1000 * NSEC_PER_MSEC)
+
+static int64_t now_ns(void)
+{
+	return ktime_get_ns();
+}
+
+static void report(const char *what, const char *backend, size_t xfer, size_t ops, size_t total, int64_t elapsed)
+{
+	printf("%-6s %-7s %9zu B %10.1f MB/s %10.1f ns/op\n", what, backend, xfer,
+		elapsed ? (double)total / elapsed * 1000.0 : 0.0,
+		ops ? (double)elapsed / ops : 0.0);
+}
+
+static int run(struct pcd_dev *pcd, struct pcd_client *cl, char *buf, size_t xfer)
+{
+	size_t iters = BYTES_PER_RUN / xfer, total = 0, i;
+	const char *name = pcd_backend_name(pcd->backend);
+	int64_t start, elapsed;
+	loff_t pos;
+	ssize_t ret;
+
+	if (!pcd->ops->seekable) {
+		start = now_ns();
+		for (i = 0; i < iters; i++) {
+			ret = pcd_core_write(pcd, cl, buf, xfer, &pos, O_NONBLOCK);
+			if (ret > 0)
+				ret = pcd_core_read(pcd, cl, buf, ret, &pos, O_NONBLOCK);
+			if (ret < 0) {
+				fprintf(stderr, "%s: %s\n", name, strerror(-ret));
+				return -1;
+			}
+			total += ret;
+		}
+		report("w+r", name, xfer, iters, total, now_ns() - start);
+		return 0;
+	}
+
+	start = now_ns();
+	for (i = 0, pos = 0; i < iters; i++, pos += xfer) {
+		if (pos + xfer > pcd->size)
+			pos = 0;
+		ret = pcd_core_write(pcd, cl, buf, xfer, &pos, 0);
+		if (ret < 0) {
+			fprintf(stderr, "%s write: %s\n", name, strerror(-ret));
+			return -1;
+		}
+		total += ret;
+		pos -= ret;
+	}
+	elapsed = now_ns() - start;
+	report("write", name, xfer, iters, total, elapsed);
+
+	total = 0;
+	start = now_ns();
+	for (i = 0, pos = 0; i < iters; i++, pos += xfer) {
+		if (pos + xfer > pcd->size)
+			pos = 0;
+		ret = pcd_core_read(pcd, cl, buf, xfer, &pos, 0);
+		if (ret < 0) {
+			fprintf(stderr, "%s read: %s\n", name, strerror(-ret));
+			return -1;
+		}
+		total += ret;
+		pos -= ret;
+	}
+	elapsed = now_ns() - start;
+	report("read", name, xfer, iters, total, elapsed);
+
+	return 0;
+}
+
+static void run_seek(struct pcd_dev *pcd)
+{
+	struct file fh = { .f_mode = FMODE_READ | FMODE_WRITE };
+	int64_t start;
+	size_t i;
+
+	start = now_ns();
+	for (i = 0; i < SEEKS_PER_RUN; i++)
+		pcd_core_llseek(pcd, &fh, i & 1 ? 0 : -1, i & 1 ? SEEK_SET : SEEK_END);
+	printf("%-6s %-7s %11s %15s %10.1f ns/op\n", "llseek", pcd_backend_name(pcd->backend), "-", "-",
+		(double)(now_ns() - start) / SEEKS_PER_RUN);
+}
+
+/* Reads whole records as they come for SRC_RUN_NS, the counter payload shows
+* which ones were dropped */
+static void run_source(size_t size, u32 rate, char *buf)
+{
+	size_t xfer = MAX_XFER / SRC_REC_SIZE * SRC_REC_SIZE, total = 0, i;
+	u64 seq, next = 0, gaps = 0;
+	struct pcd_dev pcd;
+	int64_t start, elapsed;
+	loff_t pos = 0;
+	ssize_t ret;
+
+	memset(&pcd, 0, sizeof(pcd));
+	pcd.size = size;
+	pcd.perm = PERM_RDWR;
+	pcd.sn = "ubench";
+	if (pcd_core_init(&pcd, PCD_BACKEND_RING, NULL))
+		return;
+
+	pcd.src_rate = rate;
+	pcd.src_rec_size = SRC_REC_SIZE;
+	pcd.src_payload = PCD_SRC_COUNTER;
+	if (pcd_src_start(&pcd)) {
+		pcd_core_free(&pcd);
+		return;
+	}
+
+	start = now_ns();
+	while ((elapsed = now_ns() - start) < (int64_t)SRC_RUN_NS) {
+		ret = pcd_core_read(&pcd, NULL, buf, xfer, &pos, O_NONBLOCK);
+		if (ret == -EAGAIN) {
+			sched_yield();
+			continue;
+		}
+		if (ret < 0)
+			break;
+
+		for (i = 0; i < (size_t)ret; i += SRC_REC_SIZE) {
+			memcpy(&seq, buf + i, sizeof(seq));
+			seq = le64toh(seq);
+			if (seq != next)
+				gaps++;
+			next = seq + 1;
+		}
+		total += ret;
+	}
+
+	pcd_src_stop(&pcd);
+
+	printf("source %9u rec/s %10.1f rec/s read %10.1f MB/s %10lu overruns %8llu gaps\n", rate,
+		(double)total / SRC_REC_SIZE * NSEC_PER_SEC / elapsed, (double)total / elapsed * 1000.0,
+		pcd.src_overruns, (unsigned long long)gaps);
+
+	pcd_core_free(&pcd);
+}
+
+int main(int argc, char *argv[])
+{
+	static const enum pcd_backend backends[] = { PCD_BACKEND_LINEAR, PCD_BACKEND_SPARSE, PCD_BACKEND_RING };
+	static const u32 src_rates[] = { 10000, 100000, 500000, 2000000 };
+	size_t size = 4UL << 20, xfer;
+	struct pcd_client cl;
+	struct pcd_dev pcd;
+	unsigned int i;
+	u32 quantum = 0;
+	char *buf;
+
+	if (argc > 1)
+		size = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		quantum = strtoul(argv[2], NULL, 0);
+
+	if (size < MAX_XFER) {
+		printf("Device size has to be at least %lu bytes\n", MAX_XFER);
+		return 1;
+	}
+
+	if (pcd_user_init())
+		return 1;
+
+	buf = malloc(MAX_XFER);
+	if (!buf)
+		return 1;
+	memset(buf, 0xa5, MAX_XFER);
+
+	pcd_client_init(&cl);
+
+	for (i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		memset(&pcd, 0, sizeof(pcd));
+		pcd.size = size;
+		pcd.perm = PERM_RDWR;
+		pcd.sn = "ubench";
+		if (pcd_core_init(&pcd, backends[i], NULL)) {
+			fprintf(stderr, "Could not set up a %s device\n", pcd_backend_name(backends[i]));
+			break;
+		}
+		pcd.fq_quantum = quantum;
+
+		for (xfer = MIN_XFER; xfer <= MAX_XFER; xfer <<= 2)
+			if (run(&pcd, &cl, buf, xfer))
+				break;
+
+		if (pcd.ops->seekable)
+			run_seek(&pcd);
+
+		pcd_core_free(&pcd);
+	}
+
+	for (i = 0; i < sizeof(src_rates) / sizeof(src_rates[0]); i++)
+		run_source(size, src_rates[i], buf);
+
+	free(buf);
+	pcd_user_exit();
+
+	return 0;
+}
@@ -0,0 +1,528 @@
+/*
+ * Userspace implementations behind pcd_user.h
+ */
+#include "pcd_user.h"
+
+bool pcd_user_verbose;
+__thread struct task_struct pcd_user_task;
+
+static char pcd_user_zero[PAGE_SIZE] __attribute__((aligned(4096)));
+struct page pcd_user_zero_page = { .count = 1, .addr = pcd_user_zero };
+
+static struct shrinker *pcd_user_shrinker;
+static struct delayed_work *pcd_user_work;
+struct workqueue_struct *system_wq;
+
+static void __attribute__((constructor)) pcd_user_setup(void)
+{
+	pcd_user_verbose = getenv("PCD_USER_VERBOSE") != NULL;
+}
+
+struct page *alloc_page(gfp_t gfp)
+{
+	struct page *page = calloc(1, sizeof(*page));
+
+	if (!page)
+		return NULL;
+
+	page->addr = aligned_alloc(PAGE_SIZE, PAGE_SIZE);
+	if (!page->addr) {
+		free(page);
+		return NULL;
+	}
+
+	if (gfp & __GFP_ZERO)
+		memset(page->addr, 0, PAGE_SIZE);
+	page->count = 1;
+
+	return page;
+}
+
+void put_page(struct page *page)
+{
+	if (--page->count)
+		return;
+
+	free(page->addr);
+	free(page);
+}
+
+void *memchr_inv(const void *start, int c, size_t bytes)
+{
+	const u8 *p = start;
+
+	for (; bytes; p++, bytes--)
+		if (*p != (u8)c)
+			return (void *)p;
+
+	return NULL;
+}
+
+/* Equal, ignoring a trailing newline on either side */
+bool sysfs_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+
+	if (*s1 == *s2)
+		return true;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return true;
+	if (*s1 == '\n' && !s1[1] && !*s2)
+		return true;
+
+	return false;
+}
+
+/* Table driven CRC32C (Castagnoli), same result as the kernel's crc32c() */
+static u32 crc32c_table[256];
+
+static void __attribute__((constructor)) crc32c_setup(void)
+{
+	u32 crc;
+	int i, j;
+
+	for (i = 0; i < 256; i++) {
+		crc = i;
+		for (j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+		crc32c_table[i] = crc;
+	}
+}
+
+u32 crc32c(u32 crc, const void *address, unsigned int length)
+{
+	const u8 *p = address;
+
+	while (length--)
+		crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+
+	return crc;
+}
+
+/* xarray */
+
+static int xa_grow(struct xarray *xa, unsigned long index)
+{
+	unsigned long nr = xa->nr ? xa->nr : 16;
+	void **slots;
+	u8 *marks;
+
+	while (nr <= index)
+		nr *= 2;
+
+	slots = realloc(xa->slots, nr * sizeof(*slots));
+	if (!slots)
+		return -ENOMEM;
+	xa->slots = slots;
+
+	marks = realloc(xa->marks, nr);
+	if (!marks)
+		return -ENOMEM;
+	xa->marks = marks;
+
+	memset(xa->slots + xa->nr, 0, (nr - xa->nr) * sizeof(*slots));
+	memset(xa->marks + xa->nr, 0, nr - xa->nr);
+	xa->nr = nr;
+
+	return 0;
+}
+
+void *xa_store(struct xarray *xa, unsigned long index, void *entry, gfp_t gfp)
+{
+	void *old;
+	int rc;
+
+	if (index >= xa->nr) {
+		rc = xa_grow(xa, index);
+		if (rc)
+			return ERR_PTR(rc);
+	}
+
+	old = xa->slots[index];
+	xa->slots[index] = entry;
+	if (!entry)
+		xa->marks[index] = 0;
+
+	return old;
+}
+
+void *xa_erase(struct xarray *xa, unsigned long index)
+{
+	void *old = xa_load(xa, index);
+
+	if (old) {
+		xa->slots[index] = NULL;
+		xa->marks[index] = 0;
+	}
+
+	return old;
+}
+
+void xa_destroy(struct xarray *xa)
+{
+	free(xa->slots);
+	free(xa->marks);
+	xa_init(xa);
+}
+
+bool xa_get_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	return xa_load(xa, index) && (xa->marks[index] & (1u << mark));
+}
+
+void xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	if (xa_load(xa, index))
+		xa->marks[index] |= 1u << mark;
+}
+
+void xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark)
+{
+	if (xa_load(xa, index))
+		xa->marks[index] &= ~(1u << mark);
+}
+
+/* First present entry at or after *index, optionally with a mark set */
+void *xa_find(struct xarray *xa, unsigned long *index, unsigned long max, xa_mark_t filter)
+{
+	unsigned long i;
+
+	for (i = *index; i < xa->nr && i <= max; i++) {
+		if (!xa->slots[i])
+			continue;
+		if (filter != XA_PRESENT && !(xa->marks[i] & (1u << filter)))
+			continue;
+		*index = i;
+		return xa->slots[i];
+	}
+
+	return NULL;
+}
+
+/* Shrinker */
+
+struct shrinker *shrinker_alloc(unsigned int flags, const char *fmt, ...)
+{
+	return calloc(1, sizeof(struct shrinker));
+}
+
+void shrinker_register(struct shrinker *shrinker)
+{
+	pcd_user_shrinker = shrinker;
+}
+
+void shrinker_free(struct shrinker *shrinker)
+{
+	if (pcd_user_shrinker == shrinker)
+		pcd_user_shrinker = NULL;
+	free(shrinker);
+}
+
+/* One round of reclaim the way the kernel runs a shrinker, count then scan.
+* do_shrink_slab() hands scan_objects nr_scanned already set to nr_to_scan. */
+unsigned long pcd_user_shrink(unsigned long nr_to_scan)
+{
+	struct shrink_control sc = { .gfp_mask = GFP_KERNEL, .nr_to_scan = nr_to_scan, .nr_scanned = nr_to_scan };
+	unsigned long count, freed;
+
+	if (!pcd_user_shrinker)
+		return 0;
+
+	count = pcd_user_shrinker->count_objects(pcd_user_shrinker, &sc);
+	if (!count || count == SHRINK_EMPTY)
+		return 0;
+
+	freed = pcd_user_shrinker->scan_objects(pcd_user_shrinker, &sc);
+
+	return freed == SHRINK_STOP ? 0 : freed;
+}
+
+/* kthreads */
+
+static __thread struct task_struct *pcd_user_kthread;
+
+static void *pcd_user_kthread_fn(void *arg)
+{
+	struct task_struct *k = arg;
+
+	pcd_user_kthread = k;
+	k->threadfn(k->data);
+	return NULL;
+}
+
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data, const char *namefmt, ...)
+{
+	struct task_struct *k = calloc(1, sizeof(*k));
+
+	if (!k)
+		return ERR_PTR(-ENOMEM);
+
+	k->threadfn = threadfn;
+	k->data = data;
+	return k;
+}
+
+int wake_up_process(struct task_struct *p)
+{
+	if (!p->threadfn || p->started)
+		return 1;
+
+	p->started = !pthread_create(&p->thread, NULL, pcd_user_kthread_fn, p);
+	return p->started;
+}
+
+bool kthread_should_stop(void)
+{
+	return pcd_user_kthread && __atomic_load_n(&pcd_user_kthread->should_stop, __ATOMIC_ACQUIRE);
+}
+
+/* A kthread never woken up never runs its function, like in the kernel */
+int kthread_stop(struct task_struct *k)
+{
+	__atomic_store_n(&k->should_stop, true, __ATOMIC_RELEASE);
+	if (k->started)
+		pthread_join(k->thread, NULL);
+	free(k);
+	return 0;
+}
+
+/* SRCU */
+
+void synchronize_srcu(struct srcu_struct *ssp)
+{
+	int i, idx;
+
+	pthread_mutex_lock(&ssp->gp_lock);
+	for (i = 0; i < 2; i++) {
+		idx = __atomic_fetch_add(&ssp->idx, 1, __ATOMIC_SEQ_CST) & 1;
+		while (__atomic_load_n(&ssp->readers[idx], __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+	pthread_mutex_unlock(&ssp->gp_lock);
+}
+
+/* Module parameters */
+
+int param_set_uint(const char *val, const struct kernel_param *kp)
+{
+	char *end;
+	unsigned long v = strtoul(val, &end, 0);
+
+	if (end == val || v > UINT_MAX)
+		return -EINVAL;
+
+	*(unsigned int *)kp->arg = v;
+	return 0;
+}
+
+int param_get_uint(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%u\n", *(unsigned int *)kp->arg);
+}
+
+/* sysfs parsers */
+
+int kstrtou32(const char *s, unsigned int base, u32 *res)
+{
+	char *end;
+	unsigned long long v;
+
+	if (*s == '-')
+		return -EINVAL;
+
+	errno = 0;
+	v = strtoull(s, &end, base);
+	if (*end == '\n')
+		end++;
+	if (end == s || *end)
+		return -EINVAL;
+	if (errno || v > UINT_MAX)
+		return -ERANGE;
+
+	*res = v;
+	return 0;
+}
+
+int kstrtobool(const char *s, bool *res)
+{
+	switch (s[0]) {
+	case 'y': case 'Y': case '1':
+		*res = true;
+		return 0;
+	case 'n': case 'N': case '0':
+		*res = false;
+		return 0;
+	case 'o': case 'O':
+		if (s[1] == 'n' || s[1] == 'N') {
+			*res = true;
+			return 0;
+		}
+		if (s[1] == 'f' || s[1] == 'F') {
+			*res = false;
+			return 0;
+		}
+		break;
+	}
+
+	return -EINVAL;
+}
+
+/* Delayed work. The core has a single work item, one slot is enough. */
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	if (pcd_user_work == dwork)
+		return false;
+
+	pcd_user_work = dwork;
+	return true;
+}
+
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay)
+{
+	bool pending = pcd_user_work == dwork;
+
+	pcd_user_work = dwork;
+	return pending;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	bool pending = pcd_user_work == dwork;
+
+	if (pending)
+		pcd_user_work = NULL;
+	return pending;
+}
+
+void pcd_user_run_work(void)
+{
+	struct delayed_work *dwork = pcd_user_work;
+
+	if (!dwork)
+		return;
+
+	pcd_user_work = NULL;
+	dwork->work.func(&dwork->work);
+}
+
+/* Files */
+
+loff_t default_llseek(struct file *fh, loff_t offset, int whence)
+{
+	if (whence != SEEK_SET || offset < 0)
+		return -EINVAL;
+
+	fh->f_pos = offset;
+	return offset;
+}
+
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos, const void *from, size_t available)
+{
+	loff_t pos = *ppos;
+
+	if (pos < 0)
+		return -EINVAL;
+	if ((size_t)pos >= available || !count)
+		return 0;
+
+	count = min(count, available - pos);
+	memcpy(to, (const char *)from + pos, count);
+	*ppos = pos + count;
+	return count;
+}
+
+/* debugfs */
+
+struct dentry {
+	char name[64];
+	struct dentry *parent;
+	void *data;
+	const struct file_operations *fops;
+	struct dentry *next;
+};
+
+static struct dentry *pcd_user_dentries;
+
+static struct dentry *pcd_user_dentry_add(const char *name, struct dentry *parent, void *data,
+	const struct file_operations *fops)
+{
+	struct dentry *d = calloc(1, sizeof(*d));
+
+	if (!d)
+		return NULL;
+
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->parent = parent;
+	d->data = data;
+	d->fops = fops;
+	d->next = pcd_user_dentries;
+	pcd_user_dentries = d;
+	return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return pcd_user_dentry_add(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+	const struct file_operations *fops)
+{
+	return pcd_user_dentry_add(name, parent, data, fops);
+}
+
+static bool pcd_user_dentry_under(struct dentry *d, struct dentry *dir)
+{
+	for (; d; d = d->parent)
+		if (d == dir)
+			return true;
+	return false;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	struct dentry **p = &pcd_user_dentries, *d;
+
+	if (!dentry)
+		return;
+
+	/* Children are added after their parent, so they come first in the list */
+	while ((d = *p)) {
+		if (d != dentry && pcd_user_dentry_under(d, dentry)) {
+			*p = d->next;
+			free(d);
+		} else {
+			p = &d->next;
+		}
+	}
+
+	for (p = &pcd_user_dentries; *p; p = &(*p)->next) {
+		if (*p == dentry) {
+			*p = dentry->next;
+			free(dentry);
+			break;
+		}
+	}
+}
+
+int pcd_user_debugfs_open(const char *dir, const char *name, struct inode *inode, struct file *fh,
+	const struct file_operations **fops)
+{
+	struct dentry *d;
+
+	for (d = pcd_user_dentries; d; d = d->next) {
+		if (!d->fops || !d->parent || strcmp(d->name, name) || strcmp(d->parent->name, dir))
+			continue;
+
+		inode->i_private = d->data;
+		memset(fh, 0, sizeof(*fh));
+		*fops = d->fops;
+		return d->fops->open(inode, fh);
+	}
+
+	return -ENOENT;
+}
@@ -0,0 +1,648 @@
+/*
+ * Just enough of the kernel API to build pcd_core.c as a userspace library,
+ * so the data path can be benchmarked and fuzzed on a dev machine without
+ * cross compiling or a board. Force included ahead of pcd_core.c, the
+ * <linux/...> headers it asks for are empty stubs generated by the Makefile.
+ *
+ * Only single process semantics are kept: mutexes and spinlocks are pthread
+ * mutexes, signals never arrive and waits spin on their condition.
+ */
+#ifndef __PCD_USER_H
+#define __PCD_USER_H
+
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Types */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef s64 ktime_t;
+typedef uint32_t __u32;
+typedef uint64_t __u64;
+typedef uint64_t __le64;
+
+#define __user
+#define __init
+#define __exit
+#ifndef __always_inline
+#define __always_inline		inline __attribute__((always_inline))
+#endif
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+
+#define READ_ONCE(x)		(*(const volatile typeof(x) *)&(x))
+#define WRITE_ONCE(x, val)	(*(volatile typeof(x) *)&(x) = (val))
+
+#define BUILD_BUG_ON(cond)	_Static_assert(!(cond), #cond)
+
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define min3(a, b, c)		min(min(a, b), c)
+#define swap(a, b) \
+	do { typeof(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+#define ALIGN(x, a)		(((x) + (a) - 1) & ~((typeof(x))(a) - 1))
+
+#define U32_MAX			UINT32_MAX
+
+#define struct_size(p, member, n)	(sizeof(*(p)) + sizeof((p)->member[0]) * (n))
+#define cpu_to_le64(x)			htole64(x)
+
+#define NSEC_PER_SEC		1000000000ULL
+#define NSEC_PER_MSEC		1000000ULL
+
+#ifndef SSIZE_MAX
+#define SSIZE_MAX		((ssize_t)(SIZE_MAX >> 1))
+#endif
+
+/* Kernel only error code, never seen by userspace */
+#define ERESTARTSYS		512
+
+#define MAX_ERRNO		4095
+#define IS_ERR_VALUE(x)		((unsigned long)(x) >= (unsigned long)-MAX_ERRNO)
+
+static inline void *ERR_PTR(long error) { return (void *)error; }
+static inline long PTR_ERR(const void *ptr) { return (long)ptr; }
+static inline bool IS_ERR(const void *ptr) { return IS_ERR_VALUE(ptr); }
+
+static inline u64 div_u64(u64 dividend, u32 divisor) { return dividend / divisor; }
+static inline u64 div64_u64(u64 dividend, u64 divisor) { return dividend / divisor; }
+static inline u64 mul_u64_u32_div(u64 a, u32 mul, u32 divisor) { return (unsigned __int128)a * mul / divisor; }
+
+/* Module glue. module_init() becomes pcd_user_init() for the harness to call */
+
+#define EXPORT_SYMBOL_GPL(sym)	extern int pcd_user_export_##sym
+#define MODULE_LICENSE(x)	extern int pcd_user_module_license
+#define MODULE_AUTHOR(x)	extern int pcd_user_module_author
+#define MODULE_DESCRIPTION(x)	extern int pcd_user_module_description
+#define module_init(fn)		int pcd_user_init(void) { return fn(); }
+#define module_exit(fn)		void pcd_user_exit(void) { fn(); }
+#define THIS_MODULE		NULL
+
+int pcd_user_init(void);
+void pcd_user_exit(void);
+
+/* Parameters with set/get ops are set through pcd_user_param_<name>() */
+
+struct kernel_param {
+	void *arg;
+};
+
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+
+int param_set_uint(const char *val, const struct kernel_param *kp);
+int param_get_uint(char *buffer, const struct kernel_param *kp);
+
+#define module_param_cb(_name, _ops, _arg, _perm)				\
+	int pcd_user_param_##_name(const char *val)				\
+	{									\
+		struct kernel_param kp = { .arg = (_arg) };			\
+		return (_ops)->set(val, &kp);					\
+	}
+#define MODULE_PARM_DESC(_name, desc)	extern int pcd_user_module_parm_desc
+
+int pcd_user_param_dedup_interval_ms(const char *val);
+
+/* Logging, pr_info() only with PCD_USER_VERBOSE set in the environment */
+
+extern bool pcd_user_verbose;
+
+#define pr_fmt(fmt)		fmt
+#define pr_info(fmt, ...) \
+	do { if (pcd_user_verbose) printf(pr_fmt(fmt), ##__VA_ARGS__); } while (0)
+#define pr_err(fmt, ...)	fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+
+/* Allocation */
+
+#define GFP_KERNEL		0x0u
+#define GFP_HIGHUSER		0x0u
+#define __GFP_ZERO		0x100u
+
+static inline void *kmalloc(size_t size, gfp_t gfp)
+{
+	return (gfp & __GFP_ZERO) ? calloc(1, size) : malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t gfp) { return calloc(1, size); }
+static inline void *kcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void *kvmalloc(size_t size, gfp_t gfp) { return kmalloc(size, gfp); }
+static inline void *kvzalloc(size_t size, gfp_t gfp) { return calloc(1, size); }
+static inline void *kvcalloc(size_t n, size_t size, gfp_t gfp) { return calloc(n, size); }
+static inline void *kvmalloc_array(size_t n, size_t size, gfp_t gfp) { return n && size > SIZE_MAX / n ? NULL : kmalloc(n * size, gfp); }
+static inline void kfree(const void *p) { free((void *)p); }
+static inline void kvfree(const void *p) { free((void *)p); }
+
+/* Pages, refcounted so the dma-buf sharing checks in the reclaim path work */
+
+#define PAGE_SHIFT		12
+#define PAGE_SIZE		(1UL << PAGE_SHIFT)
+#define PAGE_MASK		(~(PAGE_SIZE - 1))
+#define offset_in_page(p)	((unsigned long)(p) & ~PAGE_MASK)
+
+struct page {
+	long count;
+	void *addr;
+	unsigned long private;
+};
+
+extern struct page pcd_user_zero_page;
+#define ZERO_PAGE(vaddr)	(&pcd_user_zero_page)
+
+struct page *alloc_page(gfp_t gfp);
+void put_page(struct page *page);
+
+static inline void __free_page(struct page *page) { put_page(page); }
+static inline void get_page(struct page *page) { page->count++; }
+static inline int page_count(struct page *page) { return page->count; }
+static inline void *page_address(struct page *page) { return page->addr; }
+static inline void *kmap_local_page(struct page *page) { return page->addr; }
+static inline void kunmap_local(const void *addr) { }
+static inline bool PageHighMem(struct page *page) { return false; }
+static inline void clear_highpage(struct page *page) { memset(page->addr, 0, PAGE_SIZE); }
+static inline void copy_highpage(struct page *to, struct page *from) { memcpy(to->addr, from->addr, PAGE_SIZE); }
+static inline unsigned long page_private(struct page *page) { return page->private; }
+static inline void set_page_private(struct page *page, unsigned long private) { page->private = private; }
+
+static inline void prefetch_range(void *addr, size_t len)
+{
+	char *p;
+
+	for (p = addr; p < (char *)addr + len; p += 64)
+		__builtin_prefetch(p);
+}
+
+void *memchr_inv(const void *start, int c, size_t bytes);
+bool sysfs_streq(const char *s1, const char *s2);
+u32 crc32c(u32 crc, const void *address, unsigned int length);
+
+/* Lists */
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list;
+	list->prev = list;
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	new->next = head;
+	new->prev = head->prev;
+	head->prev->next = new;
+	head->prev = new;
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+	entry->next = entry->prev = NULL;
+}
+
+static inline bool list_empty(const struct list_head *head) { return head->next == head; }
+
+static inline bool list_is_first(const struct list_head *list, const struct list_head *head)
+{
+	return list->prev == head;
+}
+
+static inline void list_rotate_left(struct list_head *head)
+{
+	struct list_head *first = head->next;
+
+	if (list_empty(head))
+		return;
+	list_del(first);
+	list_add_tail(first, head);
+}
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(head, type, member)	list_entry((head)->next, type, member)
+#define list_first_entry_or_null(head, type, member) \
+	(list_empty(head) ? NULL : list_first_entry(head, type, member))
+#define list_for_each_entry(pos, head, member)					\
+	for (pos = list_entry((head)->next, typeof(*pos), member);		\
+	     &pos->member != (head);						\
+	     pos = list_entry(pos->member.next, typeof(*pos), member))
+
+/* Hash lists and tables */
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	n->next = h->first;
+	if (h->first)
+		h->first->pprev = &n->next;
+	h->first = n;
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del_init(struct hlist_node *n)
+{
+	if (!n->pprev)
+		return;
+	*n->pprev = n->next;
+	if (n->next)
+		n->next->pprev = n->pprev;
+	n->next = NULL;
+	n->pprev = NULL;
+}
+
+#define hlist_entry_safe(ptr, type, member) \
+	({ typeof(ptr) __ptr = (ptr); __ptr ? container_of(__ptr, type, member) : NULL; })
+#define hlist_for_each_entry(pos, head, member)					\
+	for (pos = hlist_entry_safe((head)->first, typeof(*(pos)), member);	\
+	     pos;								\
+	     pos = hlist_entry_safe((pos)->member.next, typeof(*(pos)), member))
+
+#define DECLARE_HASHTABLE(name, bits)	struct hlist_head name[1 << (bits)]
+#define HASH_SIZE(name)			(sizeof(name) / sizeof((name)[0]))
+#define hash_add(ht, node, key)		hlist_add_head(node, &(ht)[(key) % HASH_SIZE(ht)])
+#define hash_del(node)			hlist_del_init(node)
+#define hash_for_each_possible(ht, obj, member, key) \
+	hlist_for_each_entry(obj, &(ht)[(key) % HASH_SIZE(ht)], member)
+
+/* Locking */
+
+struct mutex {
+	pthread_mutex_t m;
+};
+
+#define __MUTEX_INITIALIZER(name)	{ PTHREAD_MUTEX_INITIALIZER }
+#define SINGLE_DEPTH_NESTING		1
+
+static inline void mutex_init(struct mutex *lock) { pthread_mutex_init(&lock->m, NULL); }
+static inline void mutex_lock(struct mutex *lock) { pthread_mutex_lock(&lock->m); }
+static inline void mutex_unlock(struct mutex *lock) { pthread_mutex_unlock(&lock->m); }
+static inline int mutex_trylock(struct mutex *lock) { return !pthread_mutex_trylock(&lock->m); }
+#define mutex_lock_nested(lock, subclass)	mutex_lock(lock)
+
+typedef struct mutex spinlock_t;
+
+#define spin_lock_init(lock)	mutex_init(lock)
+#define spin_lock(lock)		mutex_lock(lock)
+#define spin_unlock(lock)	mutex_unlock(lock)
+
+typedef struct {
+	long counter;
+} atomic_long_t;
+
+static inline void atomic_long_inc(atomic_long_t *v) { __atomic_fetch_add(&v->counter, 1, __ATOMIC_RELAXED); }
+static inline long atomic_long_read(const atomic_long_t *v) { return __atomic_load_n(&v->counter, __ATOMIC_RELAXED); }
+
+/* RCU pointers and SRCU. Readers count themselves in one of two slots, a grace
+* period flips the slot new readers use and waits for the old one to drain,
+* twice, like the kernel does. */
+
+#define __rcu
+#define lockdep_is_held(lock)			1
+#define rcu_access_pointer(p)			__atomic_load_n(&(p), __ATOMIC_RELAXED)
+#define rcu_dereference_protected(p, c)		(p)
+#define rcu_assign_pointer(p, v)		__atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v)			WRITE_ONCE(p, v)
+#define srcu_dereference(p, ssp)		__atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+struct srcu_struct {
+	pthread_mutex_t gp_lock;
+	int idx;
+	long readers[2];
+};
+
+#define DEFINE_STATIC_SRCU(name) \
+	static struct srcu_struct name = { .gp_lock = PTHREAD_MUTEX_INITIALIZER }
+
+static inline int srcu_read_lock(struct srcu_struct *ssp)
+{
+	int idx = __atomic_load_n(&ssp->idx, __ATOMIC_SEQ_CST) & 1;
+
+	__atomic_fetch_add(&ssp->readers[idx], 1, __ATOMIC_SEQ_CST);
+	return idx;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *ssp, int idx)
+{
+	__atomic_fetch_sub(&ssp->readers[idx], 1, __ATOMIC_SEQ_CST);
+}
+
+void synchronize_srcu(struct srcu_struct *ssp);
+
+/* Scheduling. There are no signals, sleeping waits spin on their condition */
+
+struct task_struct {
+	int unused;
+	/* kthreads only */
+	pthread_t thread;
+	int (*threadfn)(void *data);
+	void *data;
+	bool started;
+	bool should_stop;
+};
+
+extern __thread struct task_struct pcd_user_task;
+#define current			(&pcd_user_task)
+
+#define TASK_RUNNING		0
+#define TASK_INTERRUPTIBLE	1
+
+static inline bool signal_pending(struct task_struct *p) { return false; }
+static inline void cond_resched(void) { }
+static inline void set_current_state(int state) { }
+static inline void __set_current_state(int state) { }
+static inline void schedule(void) { sched_yield(); }
+int wake_up_process(struct task_struct *p);
+
+/* kthreads are pthreads, started by the first wake_up_process() */
+struct task_struct *kthread_create(int (*threadfn)(void *data), void *data, const char *namefmt, ...);
+bool kthread_should_stop(void);
+int kthread_stop(struct task_struct *k);
+
+/* One thread stands in for one CPU */
+#define DEFINE_PER_CPU(type, name)	__thread type name
+#define this_cpu_dec_return(var)	(--(var))
+#define this_cpu_write(var, val)	((var) = (val))
+
+static inline u32 get_random_u32_below(u32 ceil) { return (u32)rand() % ceil; }
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *wq) { }
+static inline void wake_up_interruptible(wait_queue_head_t *wq) { }
+#define wait_event_interruptible(wq, cond) \
+	({ while (!(cond)) sched_yield(); 0; })
+
+#define HRTIMER_MODE_REL	0
+
+static inline ktime_t ns_to_ktime(u64 ns) { return ns; }
+
+static inline u64 ktime_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static inline void usleep_range(unsigned long min, unsigned long max)
+{
+	struct timespec ts = { .tv_sec = min / 1000000, .tv_nsec = min % 1000000 * 1000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static inline int schedule_hrtimeout(ktime_t *expires, int mode)
+{
+	struct timespec ts = { .tv_sec = *expires / NSEC_PER_SEC, .tv_nsec = *expires % NSEC_PER_SEC };
+
+	return nanosleep(&ts, NULL);
+}
+
+/* xarray, a flat array growing on store. Marks are a bit per index. */
+
+typedef unsigned int xa_mark_t;
+
+#define XA_MARK_0		0u
+#define XA_MARK_1		1u
+#define XA_MARK_2		2u
+#define XA_PRESENT		8u
+
+struct xarray {
+	void **slots;
+	u8 *marks;
+	unsigned long nr;
+};
+
+static inline void xa_init(struct xarray *xa) { memset(xa, 0, sizeof(*xa)); }
+static inline int xa_err(void *entry) { return IS_ERR(entry) ? PTR_ERR(entry) : 0; }
+static inline void *xa_load(struct xarray *xa, unsigned long index) { return index < xa->nr ? xa->slots[index] : NULL; }
+
+void *xa_store(struct xarray *xa, unsigned long index, void *entry, gfp_t gfp);
+void *xa_erase(struct xarray *xa, unsigned long index);
+void xa_destroy(struct xarray *xa);
+bool xa_get_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void xa_set_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void xa_clear_mark(struct xarray *xa, unsigned long index, xa_mark_t mark);
+void *xa_find(struct xarray *xa, unsigned long *index, unsigned long max, xa_mark_t filter);
+
+#define xa_for_each(xa, index, entry)						\
+	for (index = 0, entry = xa_find(xa, &index, ULONG_MAX, XA_PRESENT);	\
+	     entry;								\
+	     index++, entry = xa_find(xa, &index, ULONG_MAX, XA_PRESENT))
+
+/* Shrinker. pcd_user_shrink() stands in for memory pressure. */
+
+#define SHRINK_STOP		(~0UL)
+#define SHRINK_EMPTY		(~0UL - 1)
+
+struct shrink_control {
+	gfp_t gfp_mask;
+	unsigned long nr_to_scan;
+	unsigned long nr_scanned;
+};
+
+struct shrinker {
+	unsigned long (*count_objects)(struct shrinker *, struct shrink_control *);
+	unsigned long (*scan_objects)(struct shrinker *, struct shrink_control *);
+};
+
+struct shrinker *shrinker_alloc(unsigned int flags, const char *fmt, ...);
+void shrinker_register(struct shrinker *shrinker);
+void shrinker_free(struct shrinker *shrinker);
+unsigned long pcd_user_shrink(unsigned long nr_to_scan);
+
+/* Delayed work never runs on its own, pcd_user_run_work() runs what is queued */
+
+struct workqueue_struct;
+extern struct workqueue_struct *system_wq;
+
+struct work_struct {
+	void (*func)(struct work_struct *work);
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+#define __DELAYED_WORK_INITIALIZER(n, f, tflags)	{ .work = { .func = (f) } }
+
+static inline unsigned long msecs_to_jiffies(unsigned int m) { return m; }
+
+bool schedule_delayed_work(struct delayed_work *dwork, unsigned long delay);
+bool mod_delayed_work(struct workqueue_struct *wq, struct delayed_work *dwork, unsigned long delay);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+void pcd_user_run_work(void);
+
+/* Files */
+
+#define FMODE_READ		0x1u
+#define FMODE_WRITE		0x2u
+#define FMODE_STREAM		0x200000u
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	loff_t f_pos;
+	fmode_t f_mode;
+	unsigned int f_flags;
+	void *private_data;
+};
+
+static inline struct inode *file_inode(const struct file *f) { return NULL; }
+static inline int stream_open(struct inode *inode, struct file *filp)
+{
+	filp->f_mode |= FMODE_STREAM;
+	return 0;
+}
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *inode, struct file *fh);
+	ssize_t (*read)(struct file *fh, char __user *buf, size_t count, loff_t *f_pos);
+	loff_t (*llseek)(struct file *fh, loff_t offset, int whence);
+	int (*release)(struct inode *inode, struct file *fh);
+};
+
+loff_t default_llseek(struct file *fh, loff_t offset, int whence);
+ssize_t simple_read_from_buffer(void __user *to, size_t count, loff_t *ppos, const void *from, size_t available);
+
+/* debugfs. Files are kept in a flat list, pcd_user_debugfs_open() finds them by name. */
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+	const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+int pcd_user_debugfs_open(const char *dir, const char *name, struct inode *inode, struct file *fh,
+	const struct file_operations **fops);
+
+/* sysfs. A device is only a drvdata pointer, attributes are called directly. */
+
+typedef unsigned short umode_t;
+
+struct device {
+	void *driver_data;
+};
+
+static inline void *dev_get_drvdata(const struct device *dev) { return dev->driver_data; }
+static inline void dev_set_drvdata(struct device *dev, void *data) { dev->driver_data = data; }
+
+struct attribute {
+	const char *name;
+	umode_t mode;
+};
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr, char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr, const char *buf, size_t count);
+};
+
+struct attribute_group {
+	const char *name;
+	struct attribute **attrs;
+};
+
+#define sysfs_attr_init(attr)	do { (void)(attr); } while (0)
+#define sysfs_emit(buf, fmt, ...)	sprintf(buf, fmt, ##__VA_ARGS__)
+
+int kstrtou32(const char *s, unsigned int base, u32 *res);
+int kstrtobool(const char *s, bool *res);
+
+/* iov_iter over a single flat buffer, user and kernel addresses are the same here */
+
+#define ITER_SOURCE		1
+#define ITER_DEST		0
+
+struct kvec {
+	void *iov_base;
+	size_t iov_len;
+};
+
+struct iov_iter {
+	char *base;
+	size_t count;
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *i) { return i->count; }
+static inline void iov_iter_truncate(struct iov_iter *i, u64 count) { if (i->count > count) i->count = count; }
+static inline void iov_iter_reexpand(struct iov_iter *i, size_t count) { i->count = count; }
+
+static inline int import_ubuf(int dir, void __user *buf, size_t len, struct iov_iter *i)
+{
+	i->base = buf;
+	i->count = len;
+	return 0;
+}
+
+static inline void iov_iter_kvec(struct iov_iter *i, unsigned int dir, const struct kvec *kvec,
+	unsigned long nr_segs, size_t count)
+{
+	i->base = kvec->iov_base;
+	i->count = count;
+}
+
+static inline size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, i->count);
+	memcpy(i->base, addr, bytes);
+	i->base += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+static inline size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+	bytes = min(bytes, i->count);
+	memcpy(addr, i->base, bytes);
+	i->base += bytes;
+	i->count -= bytes;
+	return bytes;
+}
+
+#endif /* __PCD_USER_H */